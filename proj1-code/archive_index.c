@@ -0,0 +1,351 @@
+#include "archive_index.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_MAGIC "MTARIDX1"
+#define INITIAL_INDEX_CAPACITY 64
+
+// Layout of the start of an index file. Fields are stored in host byte
+// order: the index is a local cache next to the archive, not a portable format.
+typedef struct {
+    char magic[8];
+    // Size and modification time of the archive when the index was written
+    uint64_t archive_size;
+    int64_t archive_mtime_sec;
+    int64_t archive_mtime_nsec;
+    uint64_t end_offset;
+    uint64_t count;
+} index_file_header_t;
+
+// Fixed part of each index file entry, followed by 'name_len' bytes of name
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+    int64_t mtime;
+    uint32_t chksum;
+    uint32_t name_len;
+} index_file_entry_t;
+
+// Builds the name of the index file belonging to 'archive_name'
+static int index_path(const char *archive_name, char *buf, size_t buf_len) {
+    if (snprintf(buf, buf_len, "%s%s", archive_name, INDEX_SUFFIX) >= (int) buf_len) {
+        fprintf(stderr, "Error: Archive name '%s' is too long\n", archive_name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Points the hash slot for entry 'pos' at it, replacing an older entry with
+ * the same name so that lookups always see the newest version.
+ */
+static void index_insert_slot(archive_index_t *index, size_t pos) {
+    const char *name = index->entries[pos].name;
+    size_t mask = index->num_slots - 1;
+    size_t slot = file_list_hash(name) & mask;
+    while (index->slots[slot] != 0) {
+        if (strcmp(index->entries[index->slots[slot] - 1].name, name) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    index->slots[slot] = pos + 1;
+}
+
+/*
+ * Grows the entry array and hash table so one more entry fits while keeping
+ * the table at most half full.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int index_reserve(archive_index_t *index) {
+    if (index->count == index->capacity) {
+        size_t new_capacity =
+            index->capacity == 0 ? INITIAL_INDEX_CAPACITY : index->capacity * 2;
+        index_entry_t *entries = realloc(index->entries, new_capacity * sizeof(index_entry_t));
+        if (entries == NULL) {
+            perror("Failed to grow archive index");
+            return -1;
+        }
+        index->entries = entries;
+        index->capacity = new_capacity;
+    }
+
+    if ((index->count + 1) * 2 > index->num_slots) {
+        size_t new_num_slots = index->num_slots == 0 ? INITIAL_INDEX_CAPACITY * 2
+                                                     : index->num_slots * 2;
+        size_t *slots = calloc(new_num_slots, sizeof(size_t));
+        if (slots == NULL) {
+            perror("Failed to grow archive index");
+            return -1;
+        }
+        free(index->slots);
+        index->slots = slots;
+        index->num_slots = new_num_slots;
+        for (size_t i = 0; i < index->count; i++) {
+            index_insert_slot(index, i);
+        }
+    }
+    return 0;
+}
+
+// Appends an entry, taking ownership of 'name'
+static int index_append(archive_index_t *index, char *name, uint64_t offset, uint64_t size,
+                        int64_t mtime, uint32_t chksum) {
+    if (index_reserve(index) != 0) {
+        free(name);
+        return -1;
+    }
+    index_entry_t *entry = &index->entries[index->count];
+    entry->name = name;
+    entry->offset = offset;
+    entry->size = size;
+    entry->mtime = mtime;
+    entry->chksum = chksum;
+    index_insert_slot(index, index->count);
+    index->count++;
+    return 0;
+}
+
+void archive_index_init(archive_index_t *index) {
+    index->entries = NULL;
+    index->count = 0;
+    index->capacity = 0;
+    index->slots = NULL;
+    index->num_slots = 0;
+    index->end_offset = 0;
+}
+
+void archive_index_free(archive_index_t *index) {
+    for (size_t i = 0; i < index->count; i++) {
+        free(index->entries[i].name);
+    }
+    free(index->entries);
+    free(index->slots);
+    archive_index_init(index);
+}
+
+int archive_index_add(archive_index_t *index, const tar_header *header, uint64_t offset) {
+    char member_name[MEMBER_NAME_BUF_LEN];
+    get_member_name(header, member_name, sizeof(member_name));
+    char *name = strdup(member_name);
+    if (name == NULL) {
+        perror("Failed to add member to archive index");
+        return -1;
+    }
+    return index_append(index, name, offset, member_size(header),
+                        parse_octal(header->mtime, sizeof(header->mtime)),
+                        parse_octal(header->chksum, sizeof(header->chksum)));
+}
+
+int archive_index_insert(archive_index_t *index, const char *name, uint64_t offset,
+                         uint64_t size, int64_t mtime, uint32_t chksum) {
+    char *copy = strdup(name);
+    if (copy == NULL) {
+        perror("Failed to add member to archive index");
+        return -1;
+    }
+    return index_append(index, copy, offset, size, mtime, chksum);
+}
+
+int archive_index_check_header(const index_entry_t *entry, const tar_header *header) {
+    // A stale or foreign index points at blocks that are not this member's header
+    if (!verify_checksum(header) ||
+        parse_octal(header->chksum, sizeof(header->chksum)) != entry->chksum) {
+        fprintf(stderr, "Error: Header checksum mismatch for '%s'\n", entry->name);
+        return -1;
+    }
+    // The index is trusted no further than the header it points at
+    char member_name[MEMBER_NAME_BUF_LEN];
+    get_member_name(header, member_name, sizeof(member_name));
+    if (member_size(header) != entry->size || strcmp(member_name, entry->name) != 0) {
+        fprintf(stderr, "Error: Index entry for '%s' does not match its header\n", entry->name);
+        return -1;
+    }
+    return 0;
+}
+
+int archive_index_fits(const index_entry_t *entry, uint64_t data_len, uint64_t archive_size) {
+    if (entry->offset > archive_size || archive_size - entry->offset < BLOCK_SIZE) {
+        return 0;
+    }
+    return data_len <= archive_size - entry->offset - BLOCK_SIZE;
+}
+
+const index_entry_t *archive_index_find(const archive_index_t *index, const char *name) {
+    if (index->num_slots == 0) {
+        return NULL;
+    }
+    size_t mask = index->num_slots - 1;
+    size_t slot = file_list_hash(name) & mask;
+    while (index->slots[slot] != 0) {
+        const index_entry_t *entry = &index->entries[index->slots[slot] - 1];
+        if (strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+const index_entry_t *archive_index_find_before(const archive_index_t *index, const char *name,
+                                               const index_entry_t *entry) {
+    const index_entry_t *newest = archive_index_find(index, name);
+    if (newest == NULL || newest < entry) {
+        return newest;
+    }
+    // A later version exists, so walk back from 'entry' to the one before it
+    for (const index_entry_t *earlier = entry; earlier > index->entries;) {
+        earlier--;
+        if (strcmp(earlier->name, name) == 0) {
+            return earlier;
+        }
+    }
+    return NULL;
+}
+
+int archive_index_is_final(const archive_index_t *index, const index_entry_t *entry) {
+    return archive_index_find(index, entry->name) == entry;
+}
+
+int archive_index_scan(archive_index_t *index, const archive_view_t *view, size_t offset) {
+    const tar_header *header;
+    int status;
+    while ((status = archive_view_next(view, &offset, &header)) == 1) {
+        if (archive_index_add(index, header, (const char *) header - view->data) != 0) {
+            return -1;
+        }
+    }
+    if (status != 0) {
+        return -1;
+    }
+    index->end_offset = offset;
+    return 0;
+}
+
+int archive_index_exists(const char *archive_name) {
+    char path[PATH_MAX];
+    if (index_path(archive_name, path, sizeof(path)) != 0) {
+        return 0;
+    }
+    return access(path, F_OK) == 0;
+}
+
+int archive_index_load(archive_index_t *index, const char *archive_name) {
+    char path[PATH_MAX];
+    if (index_path(archive_name, path, sizeof(path)) != 0) {
+        return -1;
+    }
+
+    struct stat archive_stat;
+    if (stat(archive_name, &archive_stat) != 0) {
+        perror("Failed to stat archive file");
+        return -1;
+    }
+
+    FILE *index_fp = fopen(path, "rb");
+    if (index_fp == NULL) {
+        return 0;    // No index has been built for this archive
+    }
+
+    index_file_header_t file_header;
+    if (fread(&file_header, sizeof(file_header), 1, index_fp) != 1 ||
+        memcmp(file_header.magic, INDEX_MAGIC, sizeof(file_header.magic)) != 0 ||
+        file_header.archive_size != (uint64_t) archive_stat.st_size ||
+        file_header.archive_mtime_sec != archive_stat.st_mtim.tv_sec ||
+        file_header.archive_mtime_nsec != archive_stat.st_mtim.tv_nsec) {
+        // Unreadable, or the archive changed after the index was written
+        fclose(index_fp);
+        return 0;
+    }
+
+    for (uint64_t i = 0; i < file_header.count; i++) {
+        index_file_entry_t file_entry;
+        char *name;
+        if (fread(&file_entry, sizeof(file_entry), 1, index_fp) != 1 ||
+            file_entry.offset >= file_header.archive_size ||
+            (name = malloc(file_entry.name_len + 1)) == NULL) {
+            archive_index_free(index);
+            fclose(index_fp);
+            return 0;
+        }
+        if (fread(name, 1, file_entry.name_len, index_fp) != file_entry.name_len) {
+            free(name);
+            archive_index_free(index);
+            fclose(index_fp);
+            return 0;
+        }
+        name[file_entry.name_len] = '\0';
+        if (index_append(index, name, file_entry.offset, file_entry.size, file_entry.mtime,
+                         file_entry.chksum) != 0) {
+            archive_index_free(index);
+            fclose(index_fp);
+            return -1;
+        }
+    }
+    index->end_offset = file_header.end_offset;
+
+    if (fclose(index_fp) != 0) {
+        perror("Error closing file.");
+        archive_index_free(index);
+        return -1;
+    }
+    return 1;
+}
+
+int archive_index_save(const archive_index_t *index, const char *archive_name) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX + 4];
+    if (index_path(archive_name, path, sizeof(path)) != 0) {
+        return -1;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    struct stat archive_stat;
+    if (stat(archive_name, &archive_stat) != 0) {
+        perror("Failed to stat archive file");
+        return -1;
+    }
+
+    index_file_header_t file_header;
+    memset(&file_header, 0, sizeof(file_header));
+    memcpy(file_header.magic, INDEX_MAGIC, sizeof(file_header.magic));
+    file_header.archive_size = archive_stat.st_size;
+    file_header.archive_mtime_sec = archive_stat.st_mtim.tv_sec;
+    file_header.archive_mtime_nsec = archive_stat.st_mtim.tv_nsec;
+    file_header.end_offset = index->end_offset;
+    file_header.count = index->count;
+
+    // Written under a temporary name so readers never see a partial index
+    FILE *index_fp = fopen(tmp_path, "wb");
+    if (index_fp == NULL) {
+        perror("Failed to open index file for writing");
+        return -1;
+    }
+    int failed = fwrite(&file_header, sizeof(file_header), 1, index_fp) != 1;
+    for (size_t i = 0; i < index->count && !failed; i++) {
+        const index_entry_t *entry = &index->entries[i];
+        index_file_entry_t file_entry;
+        memset(&file_entry, 0, sizeof(file_entry));
+        file_entry.offset = entry->offset;
+        file_entry.size = entry->size;
+        file_entry.mtime = entry->mtime;
+        file_entry.chksum = entry->chksum;
+        file_entry.name_len = strlen(entry->name);
+        failed = fwrite(&file_entry, sizeof(file_entry), 1, index_fp) != 1 ||
+                 fwrite(entry->name, 1, file_entry.name_len, index_fp) != file_entry.name_len;
+    }
+    if (fclose(index_fp) != 0) {
+        failed = 1;
+    }
+    if (failed || rename(tmp_path, path) != 0) {
+        perror("Failed to write index file");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+#ifndef _ARCHIVE_INDEX_H
+#define _ARCHIVE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "minitar.h"
+
+// Suffix appended to an archive's name to form the name of its index file
+#define INDEX_SUFFIX ".idx"
+
+// Location and metadata of one member, as recorded in the index
+typedef struct {
+    char *name;
+    // Byte offset of the member's header block within the archive
+    uint64_t offset;
+    uint64_t size;
+    int64_t mtime;
+    uint32_t chksum;
+} index_entry_t;
+
+// In-memory form of an archive's sidecar index
+typedef struct {
+    // Entries in archive order; later versions of a name come after earlier ones
+    index_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    // Open-addressing hash table holding (entry position + 1), 0 marking a free slot
+    size_t *slots;
+    size_t num_slots;
+    // Offset of the end-of-archive marker, where the next appended member goes
+    uint64_t end_offset;
+} archive_index_t;
+
+// Initialize a new, empty index
+void archive_index_init(archive_index_t *index);
+
+// Free all memory associated with the index and reset it to empty
+void archive_index_free(archive_index_t *index);
+
+/*
+ * Record that the member described by 'header' starts at byte 'offset'.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int archive_index_add(archive_index_t *index, const tar_header *header, uint64_t offset);
+
+/*
+ * Record a member named 'name' whose header starts at byte 'offset', from
+ * fields already parsed out of its header.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int archive_index_insert(archive_index_t *index, const char *name, uint64_t offset,
+                         uint64_t size, int64_t mtime, uint32_t chksum);
+
+/*
+ * Look up the most recently added member named 'name'.
+ * Returns a pointer to its entry, or NULL if no such member is indexed.
+ */
+const index_entry_t *archive_index_find(const archive_index_t *index, const char *name);
+
+/*
+ * Look up the member named 'name' that was added last before 'entry', i.e.
+ * the version of that name the archive held when 'entry' was written.
+ * Returns a pointer to its entry, or NULL if no earlier member has that name.
+ */
+const index_entry_t *archive_index_find_before(const archive_index_t *index, const char *name,
+                                               const index_entry_t *entry);
+
+/*
+ * Check that 'header', read from the archive at 'entry's offset, is intact
+ * and is the header the index recorded there: its checksum must match both
+ * its own contents and the checksum stored in 'entry', and its name and size
+ * must be the entry's.
+ * Returns 0 if it does, or -1 after reporting the mismatch if it does not.
+ */
+int archive_index_check_header(const index_entry_t *entry, const tar_header *header);
+
+/*
+ * Returns 1 if the header of 'entry' and the 'data_len' bytes that follow it
+ * lie within an archive of 'archive_size' bytes, or 0 if they would run past
+ * its end, however large the entry's offset or 'data_len' are.
+ */
+int archive_index_fits(const index_entry_t *entry, uint64_t data_len, uint64_t archive_size);
+
+/*
+ * Returns 1 if 'entry' is the most recently added member with its name, i.e.
+ * the version that a full extraction leaves on disk, or 0 otherwise.
+ */
+int archive_index_is_final(const archive_index_t *index, const index_entry_t *entry);
+
+/*
+ * Add every member found in 'view' at or after byte 'offset', and set the
+ * index's end offset to the archive's end-of-archive marker.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int archive_index_scan(archive_index_t *index, const archive_view_t *view, size_t offset);
+
+// Returns 1 if the archive identified by 'archive_name' has an index file, 0 otherwise
+int archive_index_exists(const char *archive_name);
+
+/*
+ * Load the index file of the archive identified by 'archive_name' into 'index'.
+ * The index is only accepted if the size and modification time it recorded
+ * still match the archive.
+ * Returns 1 if a valid index was loaded, 0 if there is no index file or it is
+ * out of date (leaving 'index' empty), or -1 if an error occurred.
+ */
+int archive_index_load(archive_index_t *index, const char *archive_name);
+
+/*
+ * Write 'index' to the index file of the archive identified by
+ * 'archive_name', stamped with the archive's current size and modification
+ * time. The archive must not be modified afterwards without updating the index.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int archive_index_save(const archive_index_t *index, const char *archive_name);
+
+#endif    // _ARCHIVE_INDEX_H
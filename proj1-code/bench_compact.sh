@@ -0,0 +1,48 @@
+#!/bin/bash
+# bench_compact.sh
+# Measures --compact on an archive of N members of SIZE bytes after each of
+# them has been appended ROUNDS more times, so that all but 1 in ROUNDS + 1
+# member versions are superseded. Compaction reports the bytes it reclaimed
+# and its own time; listing the archive before and after shows what the
+# smaller archive saves every later header walk.
+# Usage: ./bench_compact.sh [NUM_MEMBERS] [SIZE] [ROUNDS]
+
+set -e
+
+NUM_MEMBERS=${1:-2000}
+SIZE=${2:-65536}
+ROUNDS=${3:-4}
+WORK_DIR="$(pwd)/bench_compact_files"
+ARCHIVE="$(pwd)/bench_compact.tar"
+MINITAR="$(pwd)/minitar"
+
+cleanup() {
+    rm -rf "$WORK_DIR" "$ARCHIVE"
+}
+trap cleanup EXIT
+
+time_list() {
+    local label="$1"
+    local start end
+    start=$(date +%s.%N)
+    "$MINITAR" -t -f "$ARCHIVE" > /dev/null
+    end=$(date +%s.%N)
+    awk -v s="$start" -v e="$end" -v label="$label" -v size="$(stat -c %s "$ARCHIVE")" \
+        'BEGIN { printf "list %-8s %12d bytes %8.3f s\n", label, size, e - s }'
+}
+
+echo "Creating ${NUM_MEMBERS} files of ${SIZE} bytes, appended ${ROUNDS} more times..."
+rm -rf "$WORK_DIR"
+mkdir "$WORK_DIR"
+cd "$WORK_DIR"
+for i in $(seq 1 "$NUM_MEMBERS"); do
+    head -c "$SIZE" /dev/urandom > "m$i"
+done
+"$MINITAR" -c -f "$ARCHIVE" $(seq -f "m%g" 1 "$NUM_MEMBERS")
+for round in $(seq 1 "$ROUNDS"); do
+    "$MINITAR" -a -f "$ARCHIVE" $(seq -f "m%g" 1 "$NUM_MEMBERS")
+done
+
+time_list before
+"$MINITAR" --compact -f "$ARCHIVE"
+time_list after
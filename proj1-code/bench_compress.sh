@@ -0,0 +1,123 @@
+#!/bin/bash
+# bench_compress.sh
+# Measures -z throughput and compression ratio on the test_cases/resources
+# corpus scaled up by SCALE copies, against piping a plain archive through a
+# separate gzip process, then how create -z scales from 1 to MAX_THREADS
+# compression threads (-j), how --dictionary's per-member frames compare in
+# size with compressing each member on its own and with one whole stream, and
+# how seekable archives (--seekable and --dictionary) speed up listing and
+# single-member extraction.
+# Usage: ./bench_compress.sh [SCALE] [MAX_THREADS]
+
+set -e
+
+SCALE=${1:-50}
+MAX_THREADS=${2:-$(nproc)}
+WORK_DIR="$(pwd)/bench_compress_files"
+MINITAR="$(pwd)/minitar"
+RESOURCES="$(pwd)/test_cases/resources"
+
+cleanup() {
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+echo "Creating a corpus of ${SCALE} copies of the test resources..."
+rm -rf "$WORK_DIR"
+mkdir -p "$WORK_DIR/src"
+cd "$WORK_DIR/src"
+for ((i = 0; i < SCALE; i++)); do
+    for f in "$RESOURCES"/*; do
+        cp "$f" "c${i}_$(basename "$f")"
+    done
+done
+FILES=(*)
+cd "$WORK_DIR"
+
+# Prints elapsed seconds, throughput over the uncompressed size and ratio
+report() {
+    awk -v label="$1" -v s="$2" -v e="$3" -v raw="$4" -v packed="$5" \
+        'BEGIN { t = e - s; printf "%-24s %8.3f s %8.1f MB/s  ratio %.2f\n",
+                 label, t, raw / t / 1e6, raw / packed }'
+}
+
+cd src
+start_time=$(date +%s.%N)
+"$MINITAR" -c -f ../plain.tar "${FILES[@]}"
+end_time=$(date +%s.%N)
+raw=$(stat -c %s ../plain.tar)
+report "create (uncompressed)" "$start_time" "$end_time" "$raw" "$raw"
+
+start_time=$(date +%s.%N)
+"$MINITAR" -c -f /dev/stdout "${FILES[@]}" | gzip -6 > ../piped.tar.gz
+end_time=$(date +%s.%N)
+report "create | gzip" "$start_time" "$end_time" "$raw" "$(stat -c %s ../piped.tar.gz)"
+
+start_time=$(date +%s.%N)
+"$MINITAR" -c -z -f ../inline.tar.gz "${FILES[@]}"
+end_time=$(date +%s.%N)
+report "create -z" "$start_time" "$end_time" "$raw" "$(stat -c %s ../inline.tar.gz)"
+
+for ((threads = 2; threads <= MAX_THREADS; threads *= 2)); do
+    start_time=$(date +%s.%N)
+    "$MINITAR" -c -z -j "$threads" -f ../parallel.tar.gz "${FILES[@]}"
+    end_time=$(date +%s.%N)
+    report "create -z -j $threads" "$start_time" "$end_time" "$raw" \
+        "$(stat -c %s ../parallel.tar.gz)"
+done
+
+start_time=$(date +%s.%N)
+"$MINITAR" -c --seekable -f ../seekable.tar.gz "${FILES[@]}"
+end_time=$(date +%s.%N)
+report "create --seekable" "$start_time" "$end_time" "$raw" "$(stat -c %s ../seekable.tar.gz)"
+
+start_time=$(date +%s.%N)
+"$MINITAR" -c --dictionary -f ../dictionary.tar.gz "${FILES[@]}"
+end_time=$(date +%s.%N)
+report "create --dictionary" "$start_time" "$end_time" "$raw" \
+    "$(stat -c %s ../dictionary.tar.gz)"
+
+# Every --dictionary frame can be decompressed alone, like a member gzipped on
+# its own, yet shares a dictionary; a whole stream shares everything
+per_member=0
+for f in "${FILES[@]}"; do
+    per_member=$((per_member + $(gzip -6 -c "$f" | wc -c)))
+done
+sizes() {
+    awk -v label="$1" -v packed="$2" -v raw="$raw" \
+        'BEGIN { printf "%-24s %10d bytes  ratio %.2f\n", label, packed, raw / packed }'
+}
+sizes "each member gzipped" "$per_member"
+sizes "--dictionary" "$(stat -c %s ../dictionary.tar.gz)"
+sizes "--seekable" "$(stat -c %s ../seekable.tar.gz)"
+sizes "whole stream (-z)" "$(stat -c %s ../inline.tar.gz)"
+LAST_MEMBER=${FILES[${#FILES[@]} - 1]}
+cd ..
+
+start_time=$(date +%s.%N)
+"$MINITAR" -t -f inline.tar.gz > /dev/null
+end_time=$(date +%s.%N)
+report "list (-z archive)" "$start_time" "$end_time" "$raw" "$(stat -c %s inline.tar.gz)"
+
+mkdir out
+cd out
+start_time=$(date +%s.%N)
+"$MINITAR" -x -f ../inline.tar.gz
+end_time=$(date +%s.%N)
+report "extract (-z archive)" "$start_time" "$end_time" "$raw" "$(stat -c %s ../inline.tar.gz)"
+
+# Listing and single-member lookups, where only the seekable archive can
+# avoid decompressing everything in front of the member
+for archive in inline.tar.gz seekable.tar.gz dictionary.tar.gz; do
+    start_time=$(date +%s.%N)
+    "$MINITAR" -t -f "../$archive" > /dev/null
+    end_time=$(date +%s.%N)
+    awk -v label="list $archive" -v s="$start_time" -v e="$end_time" \
+        'BEGIN { printf "%-40s %8.3f s\n", label, e - s }'
+
+    start_time=$(date +%s.%N)
+    "$MINITAR" -x -f "../$archive" "$LAST_MEMBER"
+    end_time=$(date +%s.%N)
+    awk -v label="extract last member $archive" -v s="$start_time" -v e="$end_time" \
+        'BEGIN { printf "%-40s %8.3f s\n", label, e - s }'
+done
@@ -0,0 +1,56 @@
+#!/bin/bash
+# bench_extract.sh
+# Times extraction of the many-file test set scaled up to NUM_MEMBERS
+# members, serially and with an increasing number of writer threads (-j).
+# Usage: ./bench_extract.sh [NUM_MEMBERS] [MAX_THREADS]
+
+set -e
+
+NUM_MEMBERS=${1:-100000}
+MAX_THREADS=${2:-8}
+BATCH=10000
+WORK_DIR="$(pwd)/bench_extract_files"
+ARCHIVE="$(pwd)/bench_extract.tar"
+MINITAR="$(pwd)/minitar"
+RESOURCES="$(pwd)/test_cases/resources"
+SOURCES=(hello.txt gatsby.txt f1.txt f1.bin f2.txt f2.bin f3.txt f3.bin f4.txt f4.bin
+         f5.txt f5.bin f6.txt f6.bin f7.txt f7.bin f8.txt f8.bin f9.txt f9.bin f10.txt f10.bin)
+
+cleanup() {
+    rm -rf "$WORK_DIR" "$ARCHIVE"
+}
+trap cleanup EXIT
+
+echo "Creating ${NUM_MEMBERS} files from the many-file test set..."
+rm -rf "$WORK_DIR"
+mkdir -p "$WORK_DIR/src"
+cd "$WORK_DIR/src"
+for ((i = 0; i < ${#SOURCES[@]}; i++)); do
+    # Member k is a copy of SOURCES[k % number of sources]
+    seq -f "m%g" "$i" "${#SOURCES[@]}" "$((NUM_MEMBERS - 1))" > ../names
+    xargs -a ../names sh -c 'tee "$@" < "$0" > /dev/null' "$RESOURCES/${SOURCES[$i]}"
+done
+
+# Added in batches to stay under the argument length limit
+for ((start = 0; start < NUM_MEMBERS; start += BATCH)); do
+    end=$((start + BATCH - 1 < NUM_MEMBERS - 1 ? start + BATCH - 1 : NUM_MEMBERS - 1))
+    if ((start == 0)); then
+        "$MINITAR" -c -f "$ARCHIVE" $(seq -f "m%g" "$start" "$end")
+    else
+        "$MINITAR" -a -f "$ARCHIVE" $(seq -f "m%g" "$start" "$end")
+    fi
+done
+cd "$WORK_DIR"
+rm -rf src
+
+for threads in 1 2 4 "$MAX_THREADS"; do
+    rm -rf out
+    mkdir out
+    cd out
+    start_time=$(date +%s.%N)
+    "$MINITAR" -x -j "$threads" -f "$ARCHIVE"
+    end_time=$(date +%s.%N)
+    cd ..
+    awk -v n="$NUM_MEMBERS" -v j="$threads" -v s="$start_time" -v e="$end_time" \
+        'BEGIN { printf "members=%-8d -j %-3d %8.3f s\n", n, j, e - s }'
+done
@@ -0,0 +1,59 @@
+// Microbenchmark for file_list_t: times building, iterating over, and
+// clearing a list of many short file names.
+// Usage: ./bench_file_list [NUM_NAMES] [ROUNDS]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "file_list.h"
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    long num_names = argc > 1 ? strtol(argv[1], NULL, 10) : 100000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 10;
+    if (num_names <= 0 || rounds <= 0) {
+        fprintf(stderr, "Usage: %s [NUM_NAMES] [ROUNDS]\n", argv[0]);
+        return 1;
+    }
+
+    double build = 0, iterate = 0, clear = 0;
+    size_t checksum = 0;
+    char name[64];
+    for (int r = 0; r < rounds; r++) {
+        file_list_t list;
+        file_list_init(&list);
+
+        double start = now_seconds();
+        for (long i = 0; i < num_names; i++) {
+            snprintf(name, sizeof(name), "dir/file%ld.txt", i);
+            if (file_list_add(&list, name) != 0) {
+                fprintf(stderr, "Error: Could not add file '%s' to linked list\n", name);
+                file_list_clear(&list);
+                return 1;
+            }
+        }
+        double built = now_seconds();
+        for (const node_t *node = list.head; node != NULL; node = node->next) {
+            checksum += file_list_name_len(node->name);
+        }
+        double iterated = now_seconds();
+        file_list_clear(&list);
+        double cleared = now_seconds();
+
+        build += built - start;
+        iterate += iterated - built;
+        clear += cleared - iterated;
+    }
+
+    printf("%ld names, %d rounds (checksum %zu)\n", num_names, rounds, checksum);
+    printf("build:   %10.3f ms/round\n", build * 1000 / rounds);
+    printf("iterate: %10.3f ms/round\n", iterate * 1000 / rounds);
+    printf("clear:   %10.3f ms/round\n", clear * 1000 / rounds);
+    return 0;
+}
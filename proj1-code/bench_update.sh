@@ -0,0 +1,86 @@
+#!/bin/bash
+# bench_update.sh
+# Measures how update (-u) scales with the number of archive members (N)
+# and the number of files being updated (M). Membership of all M files is
+# checked against one header walk, so doubling M should roughly double only
+# the append work rather than multiplying the number of archive scans.
+# Each M is run first with the files unchanged, which update skips after
+# checking them, then after rewriting them, which appends them all.
+# Every run is repeated on a copy of the same archive with a minitar built
+# from BASELINE_REV (by default the repository's first commit), which walks
+# the archive once per file before appending, so both paths are reported.
+# The M files are spread evenly through the archive, since the baseline's
+# walk for a file stops at its first match.
+# The baseline has no unchanged-file check, so it appends in both cases.
+# Usage: ./bench_update.sh [NUM_MEMBERS] [NUM_TARGETS] [BASELINE_REV]
+
+set -e
+
+NUM_MEMBERS=${1:-10000}
+NUM_TARGETS=${2:-1000}
+BASELINE_REV=${3:-$(git rev-list --max-parents=0 HEAD)}
+WORK_DIR="$(pwd)/bench_update_files"
+BASELINE_DIR="$(pwd)/bench_update_baseline"
+ARCHIVE="$(pwd)/bench_update.tar"
+MINITAR="$(pwd)/minitar"
+BASELINE="$BASELINE_DIR/minitar"
+
+cleanup() {
+    rm -rf "$WORK_DIR" "$BASELINE_DIR" "$ARCHIVE"
+}
+trap cleanup EXIT
+
+echo "Building the baseline minitar from ${BASELINE_REV}..."
+rm -rf "$BASELINE_DIR"
+mkdir "$BASELINE_DIR"
+git archive "$BASELINE_REV" . | tar -x -C "$BASELINE_DIR"
+make -s -C "$BASELINE_DIR" minitar > /dev/null
+
+echo "Creating ${NUM_MEMBERS} small files..."
+rm -rf "$WORK_DIR"
+mkdir "$WORK_DIR"
+cd "$WORK_DIR"
+for i in $(seq 1 "$NUM_MEMBERS"); do
+    echo "member $i" > "m$i"
+done
+"$MINITAR" -c -f "$ARCHIVE" $(seq -f "m%g" 1 "$NUM_MEMBERS")
+
+# Times -u of $1 files spread evenly through the archive on a fresh copy of
+# it with the minitar binary $2
+time_update() {
+    local targets="$1"
+    local binary="$2"
+    local step=$((NUM_MEMBERS >= targets ? NUM_MEMBERS / targets : 1))
+    cp "$ARCHIVE" "$ARCHIVE.copy"
+    local start end
+    start=$(date +%s.%N)
+    "$binary" -u -f "$ARCHIVE.copy" $(seq -f "m%g" "$step" "$step" "$((step * targets))") \
+        2> /dev/null
+    end=$(date +%s.%N)
+    rm -f "$ARCHIVE.copy"
+    awk -v s="$start" -v e="$end" 'BEGIN { printf "%.3f", e - s }'
+}
+
+run() {
+    local targets="$1"
+    local label="$2"
+    local baseline indexed
+    baseline=$(time_update "$targets" "$BASELINE")
+    indexed=$(time_update "$targets" "$MINITAR")
+    awk -v n="$NUM_MEMBERS" -v m="$targets" -v label="$label" -v b="$baseline" \
+        -v i="$indexed" 'BEGIN { printf "N=%-8d M=%-8d %-10s %10.3f s %10.3f s %8.1fx\n",
+                                 n, m, label, b, i, b / i }'
+}
+
+printf "%-32s %12s %12s %9s\n" "" "per-file" "one walk" "speedup"
+
+for targets in $((NUM_TARGETS / 4)) $((NUM_TARGETS / 2)) "$NUM_TARGETS"; do
+    run "$targets" unchanged
+done
+
+for i in $(seq 1 "$NUM_MEMBERS"); do
+    echo "member $i, version 2" > "m$i"
+done
+for targets in $((NUM_TARGETS / 4)) $((NUM_TARGETS / 2)) "$NUM_TARGETS"; do
+    run "$targets" changed
+done
@@ -0,0 +1,58 @@
+#!/bin/bash
+# bench_walk.sh
+# Measures creating an archive of a directory tree of FANOUT^DEPTH leaf
+# directories holding FILES small files each: passing the top directory,
+# which minitar walks itself with 1 to MAX_THREADS threads (-j), against
+# expanding the tree with find and passing every file name on the command
+# line. The archives are discarded so that the walk and header work dominate.
+# Usage: ./bench_walk.sh [FANOUT] [DEPTH] [FILES] [MAX_THREADS]
+
+set -e
+
+FANOUT=${1:-8}
+DEPTH=${2:-3}
+FILES=${3:-20}
+MAX_THREADS=${4:-$(nproc)}
+WORK_DIR="$(pwd)/bench_walk_files"
+MINITAR="$(pwd)/minitar"
+
+cleanup() {
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+# Fills directory $1 with FILES files, or with FANOUT subdirectories when
+# levels ($2) remain
+make_tree() {
+    local d f
+    if (($2 == 0)); then
+        for ((f = 0; f < FILES; f++)); do
+            echo "file $f" > "$1/f$f"
+        done
+        return
+    fi
+    for ((d = 0; d < FANOUT; d++)); do
+        mkdir "$1/d$d"
+        make_tree "$1/d$d" $(($2 - 1))
+    done
+}
+
+echo "Creating a tree of ${FANOUT}^${DEPTH} directories with ${FILES} files each..."
+rm -rf "$WORK_DIR"
+mkdir -p "$WORK_DIR/tree"
+cd "$WORK_DIR"
+make_tree tree "$DEPTH"
+echo "$(find tree | wc -l) entries"
+
+start_time=$(date +%s.%N)
+find tree -type f -print0 | xargs -0 "$MINITAR" -c -f /dev/null
+end_time=$(date +%s.%N)
+awk -v s="$start_time" -v e="$end_time" 'BEGIN { printf "%-24s %8.3f s\n", "find | xargs -c", e - s }'
+
+for ((threads = 1; threads <= MAX_THREADS; threads *= 2)); do
+    start_time=$(date +%s.%N)
+    "$MINITAR" -c -j "$threads" -f /dev/null tree
+    end_time=$(date +%s.%N)
+    awk -v label="-c -j $threads tree" -v s="$start_time" -v e="$end_time" \
+        'BEGIN { printf "%-24s %8.3f s\n", label, e - s }'
+done
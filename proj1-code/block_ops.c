@@ -0,0 +1,170 @@
+#include "block_ops.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+// Contribution of the chksum field to the checksum: 8 spaces
+#define CHKSUM_BLANKS (8 * ' ')
+// Bytes of a block tested at a time when looking for a non-zero byte
+#define ZERO_GROUP_SIZE 128
+
+// Kernels used on this CPU, chosen by select_kernels before main runs
+static unsigned (*checksum_kernel)(const tar_header *header) = header_checksum_scalar;
+static size_t (*zero_run_kernel)(const char *blocks, size_t num_blocks) = zero_block_run_scalar;
+static const char *kernel_name = "scalar";
+
+// Sum of the bytes currently in the chksum field, to be swapped for blanks
+static unsigned chksum_field_sum(const tar_header *header) {
+    const unsigned char *field = (const unsigned char *) header->chksum;
+    unsigned sum = 0;
+    for (size_t i = 0; i < sizeof(header->chksum); i++) {
+        sum += field[i];
+    }
+    return sum;
+}
+
+unsigned header_checksum_scalar(const tar_header *header) {
+    const unsigned char *bytes = (const unsigned char *) header;
+    unsigned sum = 0;
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        sum += bytes[i];
+    }
+    return sum - chksum_field_sum(header) + CHKSUM_BLANKS;
+}
+
+size_t zero_block_run_scalar(const char *blocks, size_t num_blocks) {
+    for (size_t b = 0; b < num_blocks; b++) {
+        const char *block = blocks + b * BLOCK_SIZE;
+        for (int i = 0; i < BLOCK_SIZE; i++) {
+            if (block[i] != '\0') {
+                return b;
+            }
+        }
+    }
+    return num_blocks;
+}
+
+#ifdef HAVE_X86_KERNELS
+// SSE2 is part of x86-64 itself, so this kernel needs no runtime check
+static unsigned header_checksum_sse2(const tar_header *header) {
+    const __m128i *blocks = (const __m128i *) header;
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (int i = 0; i < BLOCK_SIZE / 16; i++) {
+        // psadbw against zero adds up each group of 8 unsigned bytes
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128(blocks + i), zero));
+    }
+    unsigned sum = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+    return sum - chksum_field_sum(header) + CHKSUM_BLANKS;
+}
+
+__attribute__((target("avx2"))) static unsigned header_checksum_avx2(const tar_header *header) {
+    const __m256i *blocks = (const __m256i *) header;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    for (int i = 0; i < BLOCK_SIZE / 32; i++) {
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256(blocks + i), zero));
+    }
+    __m128i folded = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    unsigned sum =
+        _mm_cvtsi128_si32(folded) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(folded, folded));
+    return sum - chksum_field_sum(header) + CHKSUM_BLANKS;
+}
+
+__attribute__((target("avx512f,avx512bw"))) static unsigned header_checksum_avx512(
+    const tar_header *header) {
+    const __m512i *blocks = (const __m512i *) header;
+    __m512i zero = _mm512_setzero_si512();
+    __m512i acc = zero;
+    for (int i = 0; i < BLOCK_SIZE / 64; i++) {
+        acc = _mm512_add_epi64(acc, _mm512_sad_epu8(_mm512_loadu_si512(blocks + i), zero));
+    }
+    unsigned sum = _mm512_reduce_add_epi64(acc);
+    return sum - chksum_field_sum(header) + CHKSUM_BLANKS;
+}
+
+// The zero-run kernels OR each quarter of a block together and test it once:
+// a header is rejected by its first quarter, while an empty block costs only
+// four tests
+static size_t zero_block_run_sse2(const char *blocks, size_t num_blocks) {
+    for (size_t b = 0; b < num_blocks; b++) {
+        const __m128i *block = (const __m128i *) (blocks + b * BLOCK_SIZE);
+        for (int group = 0; group < BLOCK_SIZE / ZERO_GROUP_SIZE; group++) {
+            __m128i acc = _mm_setzero_si128();
+            for (int i = 0; i < ZERO_GROUP_SIZE / 16; i++) {
+                acc = _mm_or_si128(acc, _mm_loadu_si128(block++));
+            }
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xffff) {
+                return b;
+            }
+        }
+    }
+    return num_blocks;
+}
+
+__attribute__((target("avx2"))) static size_t zero_block_run_avx2(const char *blocks,
+                                                                   size_t num_blocks) {
+    for (size_t b = 0; b < num_blocks; b++) {
+        const __m256i *block = (const __m256i *) (blocks + b * BLOCK_SIZE);
+        for (int group = 0; group < BLOCK_SIZE / ZERO_GROUP_SIZE; group++) {
+            __m256i acc = _mm256_setzero_si256();
+            for (int i = 0; i < ZERO_GROUP_SIZE / 32; i++) {
+                acc = _mm256_or_si256(acc, _mm256_loadu_si256(block++));
+            }
+            if (!_mm256_testz_si256(acc, acc)) {
+                return b;
+            }
+        }
+    }
+    return num_blocks;
+}
+
+__attribute__((target("avx512f"))) static size_t zero_block_run_avx512(const char *blocks,
+                                                                       size_t num_blocks) {
+    for (size_t b = 0; b < num_blocks; b++) {
+        const __m512i *block = (const __m512i *) (blocks + b * BLOCK_SIZE);
+        for (int group = 0; group < BLOCK_SIZE / ZERO_GROUP_SIZE; group++) {
+            __m512i acc = _mm512_or_si512(_mm512_loadu_si512(block), _mm512_loadu_si512(block + 1));
+            block += 2;
+            if (_mm512_test_epi64_mask(acc, acc) != 0) {
+                return b;
+            }
+        }
+    }
+    return num_blocks;
+}
+#endif
+
+// Runs before main, so the kernel pointers never change once threads exist
+__attribute__((constructor)) static void select_kernels(void) {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        checksum_kernel = header_checksum_avx512;
+        zero_run_kernel = zero_block_run_avx512;
+        kernel_name = "avx512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        checksum_kernel = header_checksum_avx2;
+        zero_run_kernel = zero_block_run_avx2;
+        kernel_name = "avx2";
+    } else {
+        checksum_kernel = header_checksum_sse2;
+        zero_run_kernel = zero_block_run_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+}
+
+unsigned header_checksum(const tar_header *header) {
+    return checksum_kernel(header);
+}
+
+size_t zero_block_run(const char *blocks, size_t num_blocks) {
+    return zero_run_kernel(blocks, num_blocks);
+}
+
+const char *block_ops_implementation(void) {
+    return kernel_name;
+}
@@ -0,0 +1,37 @@
+#ifndef _BLOCK_OPS_H
+#define _BLOCK_OPS_H
+
+#include "minitar.h"
+
+/*
+ * Vectorized kernels over 512-byte tar blocks. Each operation picks the
+ * widest implementation the CPU supports (AVX-512, then AVX2, then SSE2,
+ * then plain C) once at program start-up.
+ */
+
+/*
+ * Compute the POSIX checksum of 'header': the sum of its 512 bytes taken as
+ * unsigned values, with the 8 bytes of the chksum field counted as spaces.
+ * The chksum field itself is not modified.
+ */
+unsigned header_checksum(const tar_header *header);
+
+// Portable byte-at-a-time version of header_checksum, for comparison
+unsigned header_checksum_scalar(const tar_header *header);
+
+/*
+ * Count the all-zero blocks at the start of the 'num_blocks' consecutive
+ * 512-byte blocks at 'blocks', stopping at the first block holding a
+ * non-zero byte. A run of 2 marks the end of a tar archive; longer runs in
+ * member data are holes that need not be stored.
+ */
+size_t zero_block_run(const char *blocks, size_t num_blocks);
+
+// Portable byte-at-a-time version of zero_block_run, for comparison
+size_t zero_block_run_scalar(const char *blocks, size_t num_blocks);
+
+// Returns the name of the implementation chosen for this CPU ("avx512",
+// "avx2", "sse2" or "scalar")
+const char *block_ops_implementation(void);
+
+#endif    // _BLOCK_OPS_H
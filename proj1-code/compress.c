@@ -0,0 +1,1274 @@
+#define _GNU_SOURCE
+#include "compress.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Size of zlib's own input/output buffers for a compressed stream
+#define GZIP_BUFFER_SIZE (256 * 1024)
+// Amount of tar stream compressed into each gzip member in parallel mode;
+// seekable frames hold at most this much, packing small members together
+#define GZIP_BLOCK_SIZE (1 << 20)
+// Number of blocks that may be in flight per compression thread
+#define BLOCKS_PER_THREAD 2
+// zlib windowBits value selecting a gzip wrapper around a 32 KiB window
+#define GZIP_WINDOW_BITS (15 + 16)
+// zlib windowBits value selecting a zlib wrapper, which can name a preset dictionary
+#define ZLIB_WINDOW_BITS 15
+
+// Seekable archives end with empty gzip members whose FEXTRA field carries
+// the deflated frame table and member index ("MI" subfields), followed by a
+// fixed-size trailer member ("MT") that locates them
+#define SEEKABLE_INDEX_MAGIC "MTARSIX2"
+// Dictionary-compressed archives start with this instead of a gzip header,
+// since gzip would read their first member and discard the rest
+#define DICTIONARY_MAGIC "MTARDZ02"
+#define DICTIONARY_MAGIC_SIZE 8
+// Bytes of index per empty member, the most one FEXTRA subfield can hold
+#define MAX_EXTRA_DATA (65535 - 4)
+// Fixed gzip header with FEXTRA set, a zero mtime and an unknown OS
+#define EXTRA_MEMBER_HEAD_SIZE 12
+// Subfield id and length that start the FEXTRA field
+#define SUBFIELD_HEAD_SIZE 4
+// Empty final deflate block, zero CRC32 and zero length
+#define EXTRA_MEMBER_TAIL_SIZE 10
+// Index offset, deflated length and inflated length carried by the trailer
+#define TRAILER_DATA_SIZE 24
+#define TRAILER_SIZE (EXTRA_MEMBER_HEAD_SIZE + SUBFIELD_HEAD_SIZE + TRAILER_DATA_SIZE + \
+                      EXTRA_MEMBER_TAIL_SIZE)
+// Fixed part of the index payload: magic, frame count, entry count, end offset
+#define INDEX_PAYLOAD_HEAD_SIZE 32
+// Serialized frame: compressed offset, then the tar offset unless the frames
+// are the members themselves, as in dictionary archives
+#define FRAME_SIZE 16
+#define MEMBER_FRAME_SIZE 8
+// Deflate expands nothing by more than this factor
+#define MAX_INFLATE_RATIO 1032
+// Fixed part of each serialized entry: offset, size, mtime, chksum, name length
+#define INDEX_ENTRY_HEAD_SIZE 32
+
+static const unsigned char GZIP_MAGIC[2] = {0x1f, 0x8b};
+
+int is_compressed_archive(const char *archive_name) {
+    FILE *archive_fp = fopen(archive_name, "rb");
+    if (archive_fp == NULL) {
+        perror("Unable to open archive file");
+        return -1;
+    }
+    unsigned char magic[DICTIONARY_MAGIC_SIZE];
+    size_t n = fread(magic, 1, sizeof(magic), archive_fp);
+    int failed = ferror(archive_fp);
+    if (fclose(archive_fp) != 0 || failed) {
+        perror("Error reading archive file");
+        return -1;
+    }
+    return (n >= sizeof(GZIP_MAGIC) && memcmp(magic, GZIP_MAGIC, sizeof(GZIP_MAGIC)) == 0) ||
+           (n == DICTIONARY_MAGIC_SIZE && memcmp(magic, DICTIONARY_MAGIC, n) == 0);
+}
+
+// stdio callbacks that forward the stream's buffered I/O to a gzFile
+static ssize_t gzip_cookie_read(void *cookie, char *buf, size_t size) {
+    int n = gzread(cookie, buf, size > INT_MAX ? INT_MAX : size);
+    if (n < 0) {
+        int errnum;
+        fprintf(stderr, "Error: Failed to decompress archive: %s\n", gzerror(cookie, &errnum));
+        return -1;
+    }
+    return n;
+}
+
+static ssize_t gzip_cookie_write(void *cookie, const char *buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        unsigned len = size - done > INT_MAX ? INT_MAX : size - done;
+        if (gzwrite(cookie, buf + done, len) == 0) {
+            int errnum;
+            fprintf(stderr, "Error: Failed to compress archive: %s\n", gzerror(cookie, &errnum));
+            return 0;    // stdio treats a short write as an error
+        }
+        done += len;
+    }
+    return size;
+}
+
+static int gzip_cookie_close(void *cookie) {
+    int status = gzclose(cookie);
+    if (status != Z_OK) {
+        fprintf(stderr, "Error: Failed to finish compressed archive (zlib status %d)\n", status);
+        return EOF;
+    }
+    return 0;
+}
+
+FILE *compressed_stream_open(const char *archive_name, const char *mode) {
+    int writing = strcmp(mode, "wb") == 0;
+    char gz_mode[8];
+    if (writing) {
+        snprintf(gz_mode, sizeof(gz_mode), "wb%d", GZIP_LEVEL);
+    } else {
+        snprintf(gz_mode, sizeof(gz_mode), "rb");
+    }
+
+    gzFile gz = gzopen(archive_name, gz_mode);
+    if (gz == NULL) {
+        perror("Error: Failed to open compressed archive");
+        return NULL;
+    }
+    gzbuffer(gz, GZIP_BUFFER_SIZE);
+
+    cookie_io_functions_t functions = {
+        .read = writing ? NULL : gzip_cookie_read,
+        .write = writing ? gzip_cookie_write : NULL,
+        .seek = NULL,
+        .close = gzip_cookie_close,
+    };
+    FILE *stream = fopencookie(gz, mode, functions);
+    if (stream == NULL) {
+        perror("Error: Failed to open compressed archive");
+        gzclose(gz);
+        return NULL;
+    }
+    return stream;
+}
+
+// Destination of a compressed archive's frames, and where each one started
+typedef struct {
+    int archive_fd;
+    // Compressed bytes written so far
+    uint64_t total_out;
+    // Start of every frame written, recorded for seekable archives
+    gzip_frame_t *frames;
+    size_t num_frames;
+} frame_output_t;
+
+// States of one block in the ring of in-flight blocks
+enum { BLOCK_FILLING, BLOCK_QUEUED, BLOCK_DONE, BLOCK_FAILED };
+
+typedef struct {
+    unsigned char *input;
+    size_t input_len;
+    // Position of the input's first byte in the tar stream
+    uint64_t offset;
+    // Complete gzip member holding the compressed input
+    unsigned char *output;
+    size_t output_len;
+    int state;
+} gzip_block_t;
+
+typedef struct {
+    frame_output_t out;
+    pthread_mutex_t lock;
+    // Signalled when a block is queued for compression or the stream closes
+    pthread_cond_t block_queued;
+    // Signalled when a worker finishes a block
+    pthread_cond_t block_done;
+    gzip_block_t *blocks;
+    size_t num_blocks;
+    // Sequence numbers of the block being filled, the next block for a
+    // worker to compress and the next block to be written to the file
+    size_t next_fill;
+    size_t next_compress;
+    size_t next_write;
+    int closing;
+    pthread_t *threads;
+    int num_threads;
+    int failed;
+    // Uncompressed bytes accepted so far
+    uint64_t total_in;
+    // Member index stored after the data in seekable mode, NULL otherwise
+    const archive_index_t *index;
+    // In seekable mode, where the member being received starts and ends, and
+    // the header of the next one, held back until it is complete
+    uint64_t member_start;
+    uint64_t member_end;
+    unsigned char header[BLOCK_SIZE];
+    size_t header_fill;
+} parallel_gzip_t;
+
+// Stores 'value' in the 'len' bytes at 'p', least significant byte first
+static void put_le(unsigned char *p, uint64_t value, int len) {
+    for (int i = 0; i < len; i++) {
+        p[i] = value >> (8 * i);
+    }
+}
+
+// Reads a 'len'-byte little-endian value from 'p'
+static uint64_t get_le(const unsigned char *p, int len) {
+    uint64_t value = 0;
+    for (int i = len - 1; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+/*
+ * Writes all 'len' bytes of 'buf' to 'fd'.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int write_fully(int fd, const unsigned char *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, buf + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            perror("Error: Failed to write compressed archive");
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/*
+ * Appends 'len' bytes of compressed data to 'out'.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int write_output(frame_output_t *out, const unsigned char *buf, size_t len) {
+    if (write_fully(out->archive_fd, buf, len) != 0) {
+        return -1;
+    }
+    out->total_out += len;
+    return 0;
+}
+
+/*
+ * Records that the frame holding byte 'offset' of the tar stream onwards
+ * starts at the current end of 'out'.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int record_frame(frame_output_t *out, uint64_t offset) {
+    gzip_frame_t *frames = realloc(out->frames, (out->num_frames + 1) * sizeof(gzip_frame_t));
+    if (frames == NULL) {
+        perror("Failed to record compressed frame");
+        return -1;
+    }
+    out->frames = frames;
+    out->frames[out->num_frames].compressed_offset = out->total_out;
+    out->frames[out->num_frames].offset = offset;
+    out->num_frames++;
+    return 0;
+}
+
+/*
+ * Compresses 'block's input into a standalone gzip member.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int compress_block(gzip_block_t *block) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, GZIP_LEVEL, Z_DEFLATED, GZIP_WINDOW_BITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    strm.next_in = block->input;
+    strm.avail_in = block->input_len;
+    strm.next_out = block->output;
+    // The output buffer is sized with deflateBound, so one call finishes the member
+    strm.avail_out = deflateBound(&strm, GZIP_BLOCK_SIZE);
+    int status = deflate(&strm, Z_FINISH);
+    block->output_len = strm.total_out;
+    deflateEnd(&strm);
+    return status == Z_STREAM_END ? 0 : -1;
+}
+
+static void *compress_worker(void *arg) {
+    parallel_gzip_t *pgz = arg;
+    pthread_mutex_lock(&pgz->lock);
+    while (1) {
+        while (pgz->next_compress == pgz->next_fill && !pgz->closing) {
+            pthread_cond_wait(&pgz->block_queued, &pgz->lock);
+        }
+        if (pgz->next_compress == pgz->next_fill) {
+            break;    // Closing and every queued block has been taken
+        }
+        gzip_block_t *block = &pgz->blocks[pgz->next_compress % pgz->num_blocks];
+        pgz->next_compress++;
+        pthread_mutex_unlock(&pgz->lock);
+
+        int result = compress_block(block);
+
+        pthread_mutex_lock(&pgz->lock);
+        block->state = result == 0 ? BLOCK_DONE : BLOCK_FAILED;
+        pthread_cond_broadcast(&pgz->block_done);
+    }
+    pthread_mutex_unlock(&pgz->lock);
+    return NULL;
+}
+
+/*
+ * Waits for the oldest unwritten block to be compressed and appends it to
+ * the archive file, freeing its slot in the ring.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int write_next_block(parallel_gzip_t *pgz) {
+    gzip_block_t *block = &pgz->blocks[pgz->next_write % pgz->num_blocks];
+    pthread_mutex_lock(&pgz->lock);
+    while (block->state == BLOCK_QUEUED) {
+        pthread_cond_wait(&pgz->block_done, &pgz->lock);
+    }
+    pthread_mutex_unlock(&pgz->lock);
+    if (block->state == BLOCK_FAILED) {
+        fprintf(stderr, "Error: Failed to compress archive block\n");
+        return -1;
+    }
+
+    if (pgz->index != NULL && record_frame(&pgz->out, block->offset) != 0) {
+        return -1;
+    }
+    if (write_output(&pgz->out, block->output, block->output_len) != 0) {
+        return -1;
+    }
+    block->state = BLOCK_FILLING;
+    block->input_len = 0;
+    pgz->next_write++;
+    return 0;
+}
+
+// Hands the block being filled to the workers
+static void queue_block(parallel_gzip_t *pgz) {
+    pthread_mutex_lock(&pgz->lock);
+    pgz->blocks[pgz->next_fill % pgz->num_blocks].state = BLOCK_QUEUED;
+    pgz->next_fill++;
+    pthread_cond_signal(&pgz->block_queued);
+    pthread_mutex_unlock(&pgz->lock);
+}
+
+/*
+ * Adds 'size' bytes of the tar stream to the blocks, queueing each one that
+ * fills up.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int add_input(parallel_gzip_t *pgz, const unsigned char *buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        // Output stays in order: the oldest block is written before its slot is refilled
+        if (pgz->next_fill - pgz->next_write == pgz->num_blocks &&
+            write_next_block(pgz) != 0) {
+            return -1;
+        }
+        gzip_block_t *block = &pgz->blocks[pgz->next_fill % pgz->num_blocks];
+        if (block->input_len == 0) {
+            block->offset = pgz->total_in;
+        }
+        size_t n = GZIP_BLOCK_SIZE - block->input_len;
+        if (n > size - done) {
+            n = size - done;
+        }
+        memcpy(block->input + block->input_len, buf + done, n);
+        block->input_len += n;
+        done += n;
+        pgz->total_in += n;
+        if (block->input_len == GZIP_BLOCK_SIZE) {
+            queue_block(pgz);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Adds the complete header held back in 'pgz' to the blocks. A member that
+ * does not fit in what is left of the block being filled starts a new frame,
+ * as does the member after one that was cut into several frames, so small
+ * members share frames while larger ones only ever share their first frame
+ * with the members before them. The end-of-archive blocks are not members
+ * and stay with whatever precedes them if they fit.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int add_member_header(parallel_gzip_t *pgz) {
+    int end_block = is_empty_block((const char *) pgz->header);
+    uint64_t len = BLOCK_SIZE;
+    if (!end_block) {
+        len += (member_size((const tar_header *) pgz->header) + BLOCK_SIZE - 1) / BLOCK_SIZE *
+               BLOCK_SIZE;
+    }
+    // With the ring full the slot at next_fill is the oldest unwritten block,
+    // and the member starts a new block once it is written anyway
+    const gzip_block_t *block = &pgz->blocks[pgz->next_fill % pgz->num_blocks];
+    if (pgz->next_fill - pgz->next_write < pgz->num_blocks && block->input_len > 0 &&
+        (block->input_len + len > GZIP_BLOCK_SIZE ||
+         (!end_block && block->offset > pgz->member_start))) {
+        queue_block(pgz);
+    }
+    pgz->member_start = pgz->total_in;
+    pgz->member_end = pgz->total_in + len;
+    pgz->header_fill = 0;
+    return add_input(pgz, pgz->header, BLOCK_SIZE);
+}
+
+static ssize_t parallel_gzip_write(void *cookie, const char *buf, size_t size) {
+    parallel_gzip_t *pgz = cookie;
+    if (pgz->failed) {
+        return 0;
+    }
+    if (pgz->index == NULL) {
+        if (add_input(pgz, (const unsigned char *) buf, size) != 0) {
+            pgz->failed = 1;
+            return 0;
+        }
+        return size;
+    }
+
+    // Seekable frames are cut at member boundaries, found by following the headers
+    size_t done = 0;
+    while (done < size) {
+        size_t n = size - done;
+        if (pgz->total_in == pgz->member_end) {
+            if (n > BLOCK_SIZE - pgz->header_fill) {
+                n = BLOCK_SIZE - pgz->header_fill;
+            }
+            memcpy(pgz->header + pgz->header_fill, buf + done, n);
+            pgz->header_fill += n;
+            if (pgz->header_fill == BLOCK_SIZE && add_member_header(pgz) != 0) {
+                pgz->failed = 1;
+                return 0;
+            }
+        } else {
+            if (n > pgz->member_end - pgz->total_in) {
+                n = pgz->member_end - pgz->total_in;
+            }
+            if (add_input(pgz, (const unsigned char *) buf + done, n) != 0) {
+                pgz->failed = 1;
+                return 0;
+            }
+        }
+        done += n;
+    }
+    return size;
+}
+
+// Stops the workers and frees everything but the archive descriptor
+static void parallel_gzip_free(parallel_gzip_t *pgz) {
+    pthread_mutex_lock(&pgz->lock);
+    pgz->closing = 1;
+    pthread_cond_broadcast(&pgz->block_queued);
+    pthread_mutex_unlock(&pgz->lock);
+    for (int i = 0; i < pgz->num_threads; i++) {
+        pthread_join(pgz->threads[i], NULL);
+    }
+    for (size_t i = 0; i < pgz->num_blocks; i++) {
+        free(pgz->blocks[i].input);
+        free(pgz->blocks[i].output);
+    }
+    pthread_cond_destroy(&pgz->block_done);
+    pthread_cond_destroy(&pgz->block_queued);
+    pthread_mutex_destroy(&pgz->lock);
+    free(pgz->blocks);
+    free(pgz->threads);
+    free(pgz->out.frames);
+    free(pgz);
+}
+
+// Only reports the position, which ftello needs to record member offsets
+static int parallel_gzip_seek(void *cookie, off64_t *offset, int whence) {
+    parallel_gzip_t *pgz = cookie;
+    if (whence != SEEK_CUR || *offset != 0) {
+        errno = ESPIPE;
+        return -1;
+    }
+    *offset = pgz->total_in + pgz->header_fill;
+    return 0;
+}
+
+/*
+ * Writes an empty gzip member whose FEXTRA field holds one subfield with
+ * id 'id' and the 'len' bytes of 'data'.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int write_extra_member(frame_output_t *out, const char *id, const unsigned char *data,
+                              size_t len) {
+    unsigned char head[EXTRA_MEMBER_HEAD_SIZE + SUBFIELD_HEAD_SIZE] = {
+        0x1f, 0x8b, Z_DEFLATED, 0x04, 0, 0, 0, 0, 0, 0xff};
+    put_le(head + 10, SUBFIELD_HEAD_SIZE + len, 2);
+    head[12] = id[0];
+    head[13] = id[1];
+    put_le(head + 14, len, 2);
+    unsigned char tail[EXTRA_MEMBER_TAIL_SIZE] = {0x03, 0x00};
+    if (write_output(out, head, sizeof(head)) != 0 || write_output(out, data, len) != 0 ||
+        write_output(out, tail, sizeof(tail)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Compresses the 'len' bytes of 'data' with zlib into a newly allocated
+ * buffer, storing its length in 'deflated_len'.
+ * Returns the buffer, or NULL if an error occurs
+ */
+static unsigned char *deflate_metadata(const unsigned char *data, size_t len,
+                                       size_t *deflated_len) {
+    uLongf bound = compressBound(len);
+    unsigned char *deflated = malloc(bound);
+    if (deflated == NULL) {
+        perror("Failed to allocate compression buffer");
+        return NULL;
+    }
+    if (compress2(deflated, &bound, data, len, Z_BEST_COMPRESSION) != Z_OK) {
+        fprintf(stderr, "Error: Failed to compress archive index\n");
+        free(deflated);
+        return NULL;
+    }
+    *deflated_len = bound;
+    return deflated;
+}
+
+/*
+ * Appends the frame table of 'out' and the member index 'index' of a
+ * seekable archive, deflated, then the trailer that points back at them.
+ * When 'member_frames' is set, frame i starts at member i (and any frame
+ * after the last member at the end-of-archive marker), so only the frames'
+ * compressed offsets are stored.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int write_seekable_index(frame_output_t *out, const archive_index_t *index,
+                                int member_frames) {
+    size_t frame_size = member_frames ? MEMBER_FRAME_SIZE : FRAME_SIZE;
+    size_t payload_len = INDEX_PAYLOAD_HEAD_SIZE + out->num_frames * frame_size;
+    for (size_t i = 0; i < index->count; i++) {
+        payload_len += INDEX_ENTRY_HEAD_SIZE + strlen(index->entries[i].name);
+    }
+    unsigned char *payload = malloc(payload_len);
+    if (payload == NULL) {
+        perror("Failed to build seekable index");
+        return -1;
+    }
+
+    unsigned char *p = payload;
+    memcpy(p, SEEKABLE_INDEX_MAGIC, 8);
+    put_le(p + 8, out->num_frames, 8);
+    put_le(p + 16, index->count, 8);
+    put_le(p + 24, index->end_offset, 8);
+    p += INDEX_PAYLOAD_HEAD_SIZE;
+    for (size_t i = 0; i < out->num_frames; i++, p += frame_size) {
+        put_le(p, out->frames[i].compressed_offset, 8);
+        if (!member_frames) {
+            put_le(p + 8, out->frames[i].offset, 8);
+        }
+    }
+    for (size_t i = 0; i < index->count; i++) {
+        const index_entry_t *entry = &index->entries[i];
+        size_t name_len = strlen(entry->name);
+        put_le(p, entry->offset, 8);
+        put_le(p + 8, entry->size, 8);
+        put_le(p + 16, entry->mtime, 8);
+        put_le(p + 24, entry->chksum, 4);
+        put_le(p + 28, name_len, 4);
+        memcpy(p + INDEX_ENTRY_HEAD_SIZE, entry->name, name_len);
+        p += INDEX_ENTRY_HEAD_SIZE + name_len;
+    }
+
+    size_t deflated_len;
+    unsigned char *deflated = deflate_metadata(payload, payload_len, &deflated_len);
+    free(payload);
+    if (deflated == NULL) {
+        return -1;
+    }
+
+    uint64_t index_offset = out->total_out;
+    int result = 0;
+    for (size_t done = 0; done < deflated_len && result == 0; done += MAX_EXTRA_DATA) {
+        size_t len = deflated_len - done < MAX_EXTRA_DATA ? deflated_len - done : MAX_EXTRA_DATA;
+        result = write_extra_member(out, "MI", deflated + done, len);
+    }
+    free(deflated);
+
+    unsigned char trailer[TRAILER_DATA_SIZE];
+    put_le(trailer, index_offset, 8);
+    put_le(trailer + 8, deflated_len, 8);
+    put_le(trailer + 16, payload_len, 8);
+    if (result == 0) {
+        result = write_extra_member(out, "MT", trailer, sizeof(trailer));
+    }
+    return result;
+}
+
+static int parallel_gzip_close(void *cookie) {
+    parallel_gzip_t *pgz = cookie;
+    int failed = pgz->failed;
+    if (!failed) {
+        // A header cut short by the end of the stream is still compressed
+        if (pgz->header_fill > 0 && add_input(pgz, pgz->header, pgz->header_fill) != 0) {
+            failed = 1;
+        }
+        // The partial last block; an empty stream still becomes one empty member.
+        // A stream ending on a block boundary has no partial block, and with
+        // the ring full the slot at next_fill is the oldest unwritten block
+        gzip_block_t *block = &pgz->blocks[pgz->next_fill % pgz->num_blocks];
+        if (!failed && pgz->next_fill - pgz->next_write < pgz->num_blocks &&
+            (block->input_len > 0 || pgz->next_fill == 0)) {
+            queue_block(pgz);
+        }
+        while (!failed && pgz->next_write < pgz->next_fill) {
+            failed = write_next_block(pgz) != 0;
+        }
+        if (!failed && pgz->index != NULL) {
+            failed = write_seekable_index(&pgz->out, pgz->index, 0) != 0;
+        }
+    }
+    // Blocks still queued after a failure are compressed by the workers
+    // before they exit, and then dropped
+    int archive_fd = pgz->out.archive_fd;
+    parallel_gzip_free(pgz);
+    if (close(archive_fd) != 0) {
+        perror("Error closing file.");
+        failed = 1;
+    }
+    return failed ? EOF : 0;
+}
+
+FILE *parallel_compressed_stream_open(const char *archive_name, int num_threads,
+                                      const archive_index_t *index) {
+    parallel_gzip_t *pgz = calloc(1, sizeof(parallel_gzip_t));
+    if (pgz == NULL) {
+        perror("Failed to allocate compression threads");
+        return NULL;
+    }
+    pthread_mutex_init(&pgz->lock, NULL);
+    pthread_cond_init(&pgz->block_queued, NULL);
+    pthread_cond_init(&pgz->block_done, NULL);
+    pgz->index = index;
+    pgz->num_blocks = (size_t) num_threads * BLOCKS_PER_THREAD;
+    pgz->blocks = calloc(pgz->num_blocks, sizeof(gzip_block_t));
+    pgz->threads = malloc(num_threads * sizeof(pthread_t));
+    if (pgz->blocks == NULL || pgz->threads == NULL) {
+        perror("Failed to allocate compression threads");
+        pgz->num_blocks = 0;
+        parallel_gzip_free(pgz);
+        return NULL;
+    }
+
+    // Every block's output buffer can hold the worst-case member size
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, GZIP_LEVEL, Z_DEFLATED, GZIP_WINDOW_BITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "Error: Failed to initialize compression\n");
+        parallel_gzip_free(pgz);
+        return NULL;
+    }
+    size_t output_size = deflateBound(&strm, GZIP_BLOCK_SIZE);
+    deflateEnd(&strm);
+    for (size_t i = 0; i < pgz->num_blocks; i++) {
+        pgz->blocks[i].input = malloc(GZIP_BLOCK_SIZE);
+        pgz->blocks[i].output = malloc(output_size);
+        if (pgz->blocks[i].input == NULL || pgz->blocks[i].output == NULL) {
+            perror("Failed to allocate compression buffers");
+            parallel_gzip_free(pgz);
+            return NULL;
+        }
+    }
+
+    for (; pgz->num_threads < num_threads; pgz->num_threads++) {
+        if (pthread_create(&pgz->threads[pgz->num_threads], NULL, compress_worker, pgz) != 0) {
+            break;
+        }
+    }
+    if (pgz->num_threads == 0) {
+        fprintf(stderr, "Error: Failed to start compression threads\n");
+        parallel_gzip_free(pgz);
+        return NULL;
+    }
+
+    pgz->out.archive_fd = open(archive_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (pgz->out.archive_fd < 0) {
+        perror("Error: Failed to open archive file for writing");
+        parallel_gzip_free(pgz);
+        return NULL;
+    }
+
+    cookie_io_functions_t functions = {
+        .read = NULL,
+        .write = parallel_gzip_write,
+        .seek = index != NULL ? parallel_gzip_seek : NULL,
+        .close = parallel_gzip_close,
+    };
+    FILE *stream = fopencookie(pgz, "wb", functions);
+    if (stream == NULL) {
+        perror("Error: Failed to open compressed archive");
+        close(pgz->out.archive_fd);
+        parallel_gzip_free(pgz);
+        return NULL;
+    }
+    return stream;
+}
+
+// Streams a tar archive into member-aligned zlib frames that share a dictionary
+typedef struct {
+    frame_output_t out;
+    z_stream strm;
+    unsigned char dictionary[MAX_DICTIONARY_SIZE];
+    size_t dictionary_len;
+    // Staging area for compressed output
+    unsigned char *buffer;
+    // Position in the tar stream, and where the current member's data ends
+    // (UINT64_MAX while its header has not been fully received)
+    uint64_t total_in;
+    uint64_t member_end;
+    unsigned char header[BLOCK_SIZE];
+    size_t header_fill;
+    int frame_started;
+    // Offset of the header of the member being received
+    uint64_t member_start;
+    archive_index_t index;
+    int failed;
+} dictionary_stream_t;
+
+/*
+ * Compresses 'len' bytes of 'data' into the current frame, finishing the
+ * frame if 'flush' is Z_FINISH.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int deflate_to_output(dictionary_stream_t *ds, const unsigned char *data, size_t len,
+                             int flush) {
+    ds->strm.next_in = (unsigned char *) data;
+    ds->strm.avail_in = len;
+    do {
+        ds->strm.next_out = ds->buffer;
+        ds->strm.avail_out = GZIP_BUFFER_SIZE;
+        if (deflate(&ds->strm, flush) == Z_STREAM_ERROR) {
+            fprintf(stderr, "Error: Failed to compress archive\n");
+            return -1;
+        }
+        if (write_output(&ds->out, ds->buffer, GZIP_BUFFER_SIZE - ds->strm.avail_out) != 0) {
+            return -1;
+        }
+    } while (ds->strm.avail_out == 0);
+    return 0;
+}
+
+/*
+ * Ends the current frame, if any, and starts a new one primed with the
+ * dictionary at the current position of the tar stream.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int start_dictionary_frame(dictionary_stream_t *ds) {
+    if (ds->frame_started) {
+        if (deflate_to_output(ds, NULL, 0, Z_FINISH) != 0) {
+            return -1;
+        }
+        deflateReset(&ds->strm);
+    }
+    ds->frame_started = 1;
+    if (deflateSetDictionary(&ds->strm, ds->dictionary, ds->dictionary_len) != Z_OK) {
+        fprintf(stderr, "Error: Failed to load compression dictionary\n");
+        return -1;
+    }
+    return record_frame(&ds->out, ds->total_in);
+}
+
+static ssize_t dictionary_stream_write(void *cookie, const char *buf, size_t size) {
+    dictionary_stream_t *ds = cookie;
+    if (ds->failed) {
+        return 0;
+    }
+    size_t done = 0;
+    while (done < size) {
+        if (ds->total_in == ds->member_end) {
+            // A member (or the end-of-archive marker) starts here: cut a frame
+            if (start_dictionary_frame(ds) != 0) {
+                ds->failed = 1;
+                return 0;
+            }
+            ds->member_start = ds->total_in;
+            ds->member_end = UINT64_MAX;
+            ds->header_fill = 0;
+        }
+
+        size_t n = size - done;
+        if (ds->header_fill < BLOCK_SIZE) {
+            // Keep a copy of the header to find where the member ends
+            if (n > BLOCK_SIZE - ds->header_fill) {
+                n = BLOCK_SIZE - ds->header_fill;
+            }
+            memcpy(ds->header + ds->header_fill, buf + done, n);
+            ds->header_fill += n;
+            if (ds->header_fill == BLOCK_SIZE) {
+                const tar_header *header = (const tar_header *) ds->header;
+                if (is_empty_block((const char *) ds->header)) {
+                    // The rest of the stream is the end-of-archive marker,
+                    // kept in one frame so that frame i holds member i
+                    ds->member_end = UINT64_MAX;
+                } else {
+                    ds->member_end = ds->member_start + BLOCK_SIZE +
+                                     (member_size(header) + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+                    ds->index.end_offset = ds->member_end;
+                    if (archive_index_add(&ds->index, header, ds->member_start) != 0) {
+                        ds->failed = 1;
+                        return 0;
+                    }
+                }
+            }
+        } else if (n > ds->member_end - ds->total_in) {
+            n = ds->member_end - ds->total_in;
+        }
+
+        if (deflate_to_output(ds, (const unsigned char *) buf + done, n, Z_NO_FLUSH) != 0) {
+            ds->failed = 1;
+            return 0;
+        }
+        done += n;
+        ds->total_in += n;
+    }
+    return size;
+}
+
+static void dictionary_stream_free(dictionary_stream_t *ds) {
+    deflateEnd(&ds->strm);
+    archive_index_free(&ds->index);
+    free(ds->out.frames);
+    free(ds->buffer);
+    free(ds);
+}
+
+static int dictionary_stream_close(void *cookie) {
+    dictionary_stream_t *ds = cookie;
+    int failed = ds->failed;
+    if (!failed) {
+        failed = (!ds->frame_started && start_dictionary_frame(ds) != 0) ||
+                 deflate_to_output(ds, NULL, 0, Z_FINISH) != 0 ||
+                 write_seekable_index(&ds->out, &ds->index, 1) != 0;
+    }
+    int archive_fd = ds->out.archive_fd;
+    dictionary_stream_free(ds);
+    if (close(archive_fd) != 0) {
+        perror("Error closing file.");
+        failed = 1;
+    }
+    return failed ? EOF : 0;
+}
+
+FILE *dictionary_stream_open(const char *archive_name, const unsigned char *dictionary,
+                             size_t dictionary_len) {
+    dictionary_stream_t *ds = calloc(1, sizeof(dictionary_stream_t));
+    if (ds == NULL) {
+        perror("Failed to allocate compression state");
+        return NULL;
+    }
+    archive_index_init(&ds->index);
+    if (deflateInit2(&ds->strm, GZIP_LEVEL, Z_DEFLATED, ZLIB_WINDOW_BITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "Error: Failed to initialize compression\n");
+        free(ds);
+        return NULL;
+    }
+    ds->buffer = malloc(GZIP_BUFFER_SIZE);
+    if (ds->buffer == NULL) {
+        perror("Failed to allocate compression buffer");
+        dictionary_stream_free(ds);
+        return NULL;
+    }
+    ds->dictionary_len = dictionary_len < MAX_DICTIONARY_SIZE ? dictionary_len : MAX_DICTIONARY_SIZE;
+    memcpy(ds->dictionary, dictionary, ds->dictionary_len);
+
+    ds->out.archive_fd = open(archive_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (ds->out.archive_fd < 0) {
+        perror("Error: Failed to open archive file for writing");
+        dictionary_stream_free(ds);
+        return NULL;
+    }
+    // The dictionary is stored once, deflated, ahead of every frame that uses it
+    size_t deflated_len;
+    unsigned char *deflated = deflate_metadata(ds->dictionary, ds->dictionary_len, &deflated_len);
+    if (deflated == NULL ||
+        write_output(&ds->out, (const unsigned char *) DICTIONARY_MAGIC,
+                     DICTIONARY_MAGIC_SIZE) != 0 ||
+        write_extra_member(&ds->out, "MD", deflated, deflated_len) != 0) {
+        free(deflated);
+        close(ds->out.archive_fd);
+        dictionary_stream_free(ds);
+        return NULL;
+    }
+    free(deflated);
+
+    cookie_io_functions_t functions = {
+        .read = NULL,
+        .write = dictionary_stream_write,
+        .seek = NULL,
+        .close = dictionary_stream_close,
+    };
+    FILE *stream = fopencookie(ds, "wb", functions);
+    if (stream == NULL) {
+        perror("Error: Failed to open compressed archive");
+        close(ds->out.archive_fd);
+        dictionary_stream_free(ds);
+        return NULL;
+    }
+    return stream;
+}
+
+// Returns the number of the last frame of 'frames' that starts at or before
+// byte 'offset' of the tar stream
+static size_t find_frame(const frame_table_t *frames, uint64_t offset) {
+    size_t low = 0;
+    size_t high = frames->count;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (frames->frames[mid].offset <= offset) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * Parses the index payload of a seekable archive into 'index' and 'frames'.
+ * With 'member_frames' set, frame i starts at member i, or at the
+ * end-of-archive marker once the members run out.
+ * Returns 0 on success or -1 if the payload is malformed
+ */
+static int parse_seekable_index(const unsigned char *payload, size_t len,
+                                archive_index_t *index, frame_table_t *frames,
+                                int member_frames) {
+    if (len < INDEX_PAYLOAD_HEAD_SIZE || memcmp(payload, SEEKABLE_INDEX_MAGIC, 8) != 0) {
+        return -1;
+    }
+    uint64_t num_frames = get_le(payload + 8, 8);
+    uint64_t num_entries = get_le(payload + 16, 8);
+    size_t frame_size = member_frames ? MEMBER_FRAME_SIZE : FRAME_SIZE;
+    size_t pos = INDEX_PAYLOAD_HEAD_SIZE;
+    if (num_frames == 0 || num_frames > (len - pos) / frame_size ||
+        (member_frames && (num_frames < num_entries || num_frames > num_entries + 1))) {
+        return -1;
+    }
+    frames->frames = malloc(num_frames * sizeof(gzip_frame_t));
+    if (frames->frames == NULL) {
+        return -1;
+    }
+    for (; frames->count < num_frames; frames->count++, pos += frame_size) {
+        frames->frames[frames->count].compressed_offset = get_le(payload + pos, 8);
+        if (!member_frames) {
+            frames->frames[frames->count].offset = get_le(payload + pos + 8, 8);
+        }
+    }
+
+    for (uint64_t i = 0; i < num_entries; i++) {
+        if (len - pos < INDEX_ENTRY_HEAD_SIZE) {
+            return -1;
+        }
+        const unsigned char *p = payload + pos;
+        size_t name_len = get_le(p + 28, 4);
+        if (len - pos - INDEX_ENTRY_HEAD_SIZE < name_len || name_len >= MEMBER_NAME_BUF_LEN) {
+            return -1;
+        }
+        char name[MEMBER_NAME_BUF_LEN];
+        memcpy(name, p + INDEX_ENTRY_HEAD_SIZE, name_len);
+        name[name_len] = '\0';
+        if (archive_index_insert(index, name, get_le(p, 8), get_le(p + 8, 8),
+                                 (int64_t) get_le(p + 16, 8), get_le(p + 24, 4)) != 0) {
+            return -1;
+        }
+        pos += INDEX_ENTRY_HEAD_SIZE + name_len;
+    }
+    index->end_offset = get_le(payload + 24, 8);
+    if (member_frames) {
+        for (size_t i = 0; i < frames->count; i++) {
+            frames->frames[i].offset = i < index->count ? index->entries[i].offset
+                                                        : index->end_offset;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Reads the FEXTRA subfield of the empty gzip member at 'offset' in 'fd',
+ * which must have id 'id', into 'data' (at most 'max_len' bytes).
+ * Returns the subfield's length, or -1 if there is no such member there
+ */
+static ssize_t read_extra_member(int fd, off_t offset, const char *id, unsigned char *data,
+                                 size_t max_len) {
+    unsigned char head[EXTRA_MEMBER_HEAD_SIZE + SUBFIELD_HEAD_SIZE];
+    if (pread(fd, head, sizeof(head), offset) != sizeof(head) || head[0] != 0x1f ||
+        head[1] != 0x8b || head[3] != 0x04 || head[12] != id[0] || head[13] != id[1]) {
+        return -1;
+    }
+    size_t len = get_le(head + 14, 2);
+    if (get_le(head + 10, 2) != SUBFIELD_HEAD_SIZE + len || len > max_len ||
+        pread(fd, data, len, offset + sizeof(head)) != (ssize_t) len) {
+        return -1;
+    }
+    return len;
+}
+
+int seekable_index_load(const char *archive_name, archive_index_t *index,
+                        frame_table_t *frames) {
+    frames->frames = NULL;
+    frames->count = 0;
+    frames->dictionary = NULL;
+    frames->dictionary_len = 0;
+    int fd = open(archive_name, O_RDONLY);
+    if (fd < 0) {
+        perror("Unable to open archive file");
+        return -1;
+    }
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) != 0) {
+        perror("Failed to stat archive file");
+        close(fd);
+        return -1;
+    }
+
+    // Without a trailer the archive is an ordinary .tar.gz, and a dictionary
+    // archive cannot be read at all
+    unsigned char magic[DICTIONARY_MAGIC_SIZE];
+    int dictionary = pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+                     memcmp(magic, DICTIONARY_MAGIC, sizeof(magic)) == 0;
+    unsigned char trailer[TRAILER_DATA_SIZE];
+    if (stat_buf.st_size < TRAILER_SIZE ||
+        read_extra_member(fd, stat_buf.st_size - TRAILER_SIZE, "MT", trailer,
+                          sizeof(trailer)) != sizeof(trailer)) {
+        close(fd);
+        if (dictionary) {
+            fprintf(stderr, "Error: Seekable archive index is corrupt\n");
+            return -1;
+        }
+        return 0;
+    }
+    uint64_t index_offset = get_le(trailer, 8);
+    uint64_t deflated_len = get_le(trailer + 8, 8);
+    uint64_t payload_len = get_le(trailer + 16, 8);
+
+    int result = -1;
+    unsigned char *deflated = NULL;
+    unsigned char *payload = NULL;
+    if (index_offset < (uint64_t) stat_buf.st_size && deflated_len <= (uint64_t) stat_buf.st_size &&
+        payload_len / MAX_INFLATE_RATIO <= deflated_len &&
+        (deflated = malloc(deflated_len)) != NULL && (payload = malloc(payload_len)) != NULL) {
+        uint64_t offset = index_offset;
+        size_t done = 0;
+        while (done < deflated_len) {
+            ssize_t n = read_extra_member(fd, offset, "MI", deflated + done, deflated_len - done);
+            if (n <= 0) {
+                break;
+            }
+            done += n;
+            offset += EXTRA_MEMBER_HEAD_SIZE + SUBFIELD_HEAD_SIZE + n + EXTRA_MEMBER_TAIL_SIZE;
+        }
+        uLongf inflated_len = payload_len;
+        if (done == deflated_len &&
+            uncompress(payload, &inflated_len, deflated, deflated_len) == Z_OK &&
+            inflated_len == payload_len) {
+            result = parse_seekable_index(payload, payload_len, index, frames, dictionary);
+        }
+    }
+    // Archives whose frames share a dictionary store it, deflated, right
+    // after their magic
+    if (result == 0 && dictionary) {
+        free(deflated);
+        deflated = malloc(MAX_EXTRA_DATA);
+        frames->dictionary = malloc(MAX_DICTIONARY_SIZE);
+        if (deflated == NULL || frames->dictionary == NULL) {
+            perror("Failed to allocate compression dictionary");
+            result = -1;
+        } else {
+            ssize_t n = read_extra_member(fd, DICTIONARY_MAGIC_SIZE, "MD", deflated,
+                                          MAX_EXTRA_DATA);
+            uLongf dictionary_len = MAX_DICTIONARY_SIZE;
+            if (n < 0 || uncompress(frames->dictionary, &dictionary_len, deflated, n) != Z_OK) {
+                result = -1;
+            } else {
+                frames->dictionary_len = dictionary_len;
+            }
+        }
+    }
+    free(deflated);
+    free(payload);
+    close(fd);
+
+    if (result != 0) {
+        fprintf(stderr, "Error: Seekable archive index is corrupt\n");
+        archive_index_free(index);
+        frame_table_free(frames);
+        return -1;
+    }
+    return 1;
+}
+
+void frame_table_free(frame_table_t *frames) {
+    free(frames->frames);
+    free(frames->dictionary);
+    frames->frames = NULL;
+    frames->count = 0;
+    frames->dictionary = NULL;
+    frames->dictionary_len = 0;
+}
+
+// Reads the tar stream back out of consecutive dictionary-compressed frames
+typedef struct {
+    int archive_fd;
+    z_stream strm;
+    unsigned char *input;
+    unsigned char dictionary[MAX_DICTIONARY_SIZE];
+    size_t dictionary_len;
+    // Frames not yet fully decompressed, including the current one
+    size_t frames_left;
+} dictionary_reader_t;
+
+static ssize_t dictionary_reader_read(void *cookie, char *buf, size_t size) {
+    dictionary_reader_t *dr = cookie;
+    dr->strm.next_out = (unsigned char *) buf;
+    dr->strm.avail_out = size > UINT_MAX ? UINT_MAX : size;
+    size_t want = dr->strm.avail_out;
+    while (dr->strm.avail_out > 0 && dr->frames_left > 0) {
+        if (dr->strm.avail_in == 0) {
+            ssize_t n = read(dr->archive_fd, dr->input, GZIP_BUFFER_SIZE);
+            if (n <= 0) {
+                fprintf(stderr, "Error: Archive is truncated\n");
+                return -1;
+            }
+            dr->strm.next_in = dr->input;
+            dr->strm.avail_in = n;
+        }
+        int status = inflate(&dr->strm, Z_NO_FLUSH);
+        if (status == Z_NEED_DICT) {
+            status = inflateSetDictionary(&dr->strm, dr->dictionary, dr->dictionary_len);
+        } else if (status == Z_STREAM_END) {
+            // The next frame follows immediately
+            dr->frames_left--;
+            status = inflateReset(&dr->strm);
+        }
+        if (status != Z_OK && status != Z_BUF_ERROR) {
+            fprintf(stderr, "Error: Failed to decompress archive\n");
+            return -1;
+        }
+    }
+    return want - dr->strm.avail_out;
+}
+
+static int dictionary_reader_close(void *cookie) {
+    dictionary_reader_t *dr = cookie;
+    inflateEnd(&dr->strm);
+    int result = close(dr->archive_fd);
+    free(dr->input);
+    free(dr);
+    return result == 0 ? 0 : EOF;
+}
+
+/*
+ * Opens a reader of a dictionary-compressed archive that starts with frame
+ * number 'first' of 'frames', and discards its first 'skip' bytes.
+ * Returns the stream, or NULL if an error occurred.
+ */
+static FILE *dictionary_reader_open(const char *archive_name, const frame_table_t *frames,
+                                    size_t first, uint64_t skip) {
+    dictionary_reader_t *dr = calloc(1, sizeof(dictionary_reader_t));
+    if (dr == NULL || (dr->input = malloc(GZIP_BUFFER_SIZE)) == NULL) {
+        perror("Failed to allocate decompression state");
+        free(dr);
+        return NULL;
+    }
+    if (inflateInit2(&dr->strm, ZLIB_WINDOW_BITS) != Z_OK) {
+        fprintf(stderr, "Error: Failed to initialize decompression\n");
+        free(dr->input);
+        free(dr);
+        return NULL;
+    }
+    memcpy(dr->dictionary, frames->dictionary, frames->dictionary_len);
+    dr->dictionary_len = frames->dictionary_len;
+    dr->frames_left = frames->count - first;
+
+    cookie_io_functions_t functions = {
+        .read = dictionary_reader_read,
+        .write = NULL,
+        .seek = NULL,
+        .close = dictionary_reader_close,
+    };
+    dr->archive_fd = open(archive_name, O_RDONLY);
+    FILE *stream = NULL;
+    if (dr->archive_fd < 0 ||
+        lseek(dr->archive_fd, frames->frames[first].compressed_offset, SEEK_SET) < 0) {
+        perror("Unable to open archive file");
+    } else if ((stream = fopencookie(dr, "rb", functions)) == NULL) {
+        perror("Error: Failed to open compressed archive");
+    }
+    if (stream == NULL) {
+        if (dr->archive_fd >= 0) {
+            close(dr->archive_fd);
+        }
+        inflateEnd(&dr->strm);
+        free(dr->input);
+        free(dr);
+        return NULL;
+    }
+
+    // Only the part of the frame before the wanted byte is decompressed and dropped
+    char scratch[BLOCK_SIZE];
+    while (skip > 0) {
+        size_t n = skip < sizeof(scratch) ? skip : sizeof(scratch);
+        if (fread(scratch, 1, n, stream) != n) {
+            fprintf(stderr, "Error: Archive is truncated\n");
+            fclose(stream);
+            return NULL;
+        }
+        skip -= n;
+    }
+    return stream;
+}
+
+/*
+ * Opens the seekable archive 'archive_name' for reading from byte 'offset'
+ * of its tar stream, which lies in frame number 'first' of 'frames'.
+ * Returns the stream, or NULL if an error occurred.
+ */
+static FILE *open_in_frame(const char *archive_name, const frame_table_t *frames, size_t first,
+                           uint64_t offset) {
+    const gzip_frame_t *frame = &frames->frames[first];
+    if (frames->dictionary != NULL) {
+        return dictionary_reader_open(archive_name, frames, first, offset - frame->offset);
+    }
+
+    int fd = open(archive_name, O_RDONLY);
+    if (fd < 0) {
+        perror("Unable to open archive file");
+        return NULL;
+    }
+    // gzdopen starts decompressing at the descriptor's current position
+    if (lseek(fd, frame->compressed_offset, SEEK_SET) < 0) {
+        perror("Failed to seek in archive file");
+        close(fd);
+        return NULL;
+    }
+    gzFile gz = gzdopen(fd, "rb");
+    if (gz == NULL) {
+        perror("Error: Failed to open compressed archive");
+        close(fd);
+        return NULL;
+    }
+    gzbuffer(gz, GZIP_BUFFER_SIZE);
+    // Only the part of the frame before 'offset' is decompressed and dropped
+    if (gzseek(gz, offset - frame->offset, SEEK_CUR) < 0) {
+        fprintf(stderr, "Error: Archive is truncated\n");
+        gzclose(gz);
+        return NULL;
+    }
+
+    cookie_io_functions_t functions = {
+        .read = gzip_cookie_read,
+        .write = NULL,
+        .seek = NULL,
+        .close = gzip_cookie_close,
+    };
+    FILE *stream = fopencookie(gz, "rb", functions);
+    if (stream == NULL) {
+        perror("Error: Failed to open compressed archive");
+        gzclose(gz);
+        return NULL;
+    }
+    return stream;
+}
+
+FILE *compressed_stream_open_at(const char *archive_name, const frame_table_t *frames,
+                                uint64_t offset) {
+    return open_in_frame(archive_name, frames, find_frame(frames, offset), offset);
+}
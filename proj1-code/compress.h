@@ -0,0 +1,105 @@
+#ifndef _COMPRESS_H
+#define _COMPRESS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "archive_index.h"
+
+// Compression level used for -z archives (zlib's default trade-off)
+#define GZIP_LEVEL 6
+// Largest useful preset dictionary: deflate can only refer back 32 KiB
+#define MAX_DICTIONARY_SIZE 32768
+
+/*
+ * Check whether the archive identified by 'archive_name' is gzip-compressed
+ * or dictionary-compressed, judging by its leading magic bytes.
+ * Returns 1 if it is, 0 if it is not (including empty files), or -1 if an
+ * error occurred.
+ */
+int is_compressed_archive(const char *archive_name);
+
+/*
+ * Open the archive identified by 'archive_name' through a gzip stage.
+ * 'mode' is "wb", in which case everything written to the returned stream is
+ * compressed into a new .tar.gz file, or "rb", in which case reads return the
+ * decompressed tar stream. Closing the stream with fclose finishes the gzip
+ * member (or checks its trailer). The stream cannot seek.
+ * Returns the stream, or NULL if an error occurred.
+ */
+FILE *compressed_stream_open(const char *archive_name, const char *mode);
+
+// Start of one independently decompressible frame of a seekable archive
+typedef struct {
+    // Offset of the frame's gzip member in the archive file
+    uint64_t compressed_offset;
+    // Offset of the frame's first byte in the decompressed tar stream
+    uint64_t offset;
+} gzip_frame_t;
+
+// Every frame of a seekable archive, in order
+typedef struct {
+    gzip_frame_t *frames;
+    size_t count;
+    // Dictionary shared by the frames, or NULL if they are plain gzip members
+    unsigned char *dictionary;
+    size_t dictionary_len;
+} frame_table_t;
+
+/*
+ * Create the archive identified by 'archive_name' as a gzip file written by
+ * 'num_threads' compression threads. The tar stream written to the returned
+ * stream is cut into fixed-size blocks that are compressed independently and
+ * appended in their original order, each as its own gzip member; standard
+ * gzip readers decompress the concatenation as one stream. Closing the stream
+ * with fclose writes the last block and stops the threads.
+ * If 'index' is not NULL the archive is made seekable: blocks are cut at
+ * member boundaries instead, packing small members together and starting
+ * each larger one in a block of its own, ftello reports the position in the
+ * tar stream, and on close the blocks' offsets and 'index', which must be
+ * complete by then, are deflated and stored after the data in the FEXTRA
+ * fields of empty gzip members along with the block each member starts in, so the
+ * decompressed stream is unchanged.
+ * Returns the stream, or NULL if an error occurred.
+ */
+FILE *parallel_compressed_stream_open(const char *archive_name, int num_threads,
+                                      const archive_index_t *index);
+
+/*
+ * Create the archive identified by 'archive_name' compressed against a
+ * preset 'dictionary' of at most MAX_DICTIONARY_SIZE bytes. The archive
+ * starts with its own magic bytes rather than a gzip header, so that gzip
+ * rejects it, followed by the dictionary, stored once and deflated. Each
+ * member of the tar stream written to the returned stream, found by following
+ * its headers, becomes its own zlib frame primed with the dictionary, so
+ * members stay independently decompressible; the end-of-archive marker forms
+ * one last frame. On close the member index is stored as for a seekable
+ * archive, with only the frames' compressed offsets, since each frame starts
+ * where its member does. Only minitar can read the result.
+ * Returns the stream, or NULL if an error occurred.
+ */
+FILE *dictionary_stream_open(const char *archive_name, const unsigned char *dictionary,
+                             size_t dictionary_len);
+
+/*
+ * Load the member index and frame table stored in the seekable archive
+ * identified by 'archive_name'.
+ * Returns 1 if they were loaded, 0 if the archive is not seekable (leaving
+ * both empty), or -1 if an error occurred.
+ */
+int seekable_index_load(const char *archive_name, archive_index_t *index,
+                        frame_table_t *frames);
+
+// Free the frames loaded by seekable_index_load
+void frame_table_free(frame_table_t *frames);
+
+/*
+ * Open the seekable archive identified by 'archive_name' for reading from
+ * byte 'offset' of its tar stream. Only the frame holding that byte is
+ * decompressed from its start; reading continues through later frames.
+ * Returns the stream, or NULL if an error occurred.
+ */
+FILE *compressed_stream_open_at(const char *archive_name, const frame_table_t *frames,
+                                uint64_t offset);
+
+#endif    // _COMPRESS_H
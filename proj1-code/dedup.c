@@ -0,0 +1,247 @@
+#include "dedup.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define INITIAL_DEDUP_CAPACITY 64
+// Bytes of each file read at a time when digesting or comparing contents
+#define DEDUP_BUF_LEN (64 * 1024)
+
+// Hash of the (size, digest) pair an entry is filed under
+static size_t dedup_hash(uint64_t size, uint32_t digest) {
+    return (size_t) ((size * 0x9E3779B97F4A7C15ULL) ^ digest);
+}
+
+// Files entry 'pos' in the first free slot of its probe sequence
+static void dedup_insert_slot(dedup_table_t *table, size_t pos) {
+    const dedup_entry_t *entry = &table->entries[pos];
+    size_t mask = table->num_slots - 1;
+    size_t slot = dedup_hash(entry->size, entry->digest) & mask;
+    while (table->slots[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    table->slots[slot] = pos + 1;
+}
+
+/*
+ * Grows the entry array and hash table so one more entry fits while keeping
+ * the table at most half full.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int dedup_reserve(dedup_table_t *table) {
+    if (table->count == table->capacity) {
+        size_t new_capacity =
+            table->capacity == 0 ? INITIAL_DEDUP_CAPACITY : table->capacity * 2;
+        dedup_entry_t *entries = realloc(table->entries, new_capacity * sizeof(dedup_entry_t));
+        if (entries == NULL) {
+            perror("Failed to grow dedup table");
+            return -1;
+        }
+        table->entries = entries;
+        table->capacity = new_capacity;
+    }
+
+    if ((table->count + 1) * 2 > table->num_slots) {
+        size_t new_num_slots =
+            table->num_slots == 0 ? INITIAL_DEDUP_CAPACITY * 2 : table->num_slots * 2;
+        size_t *slots = calloc(new_num_slots, sizeof(size_t));
+        if (slots == NULL) {
+            perror("Failed to grow dedup table");
+            return -1;
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->num_slots = new_num_slots;
+        for (size_t i = 0; i < table->count; i++) {
+            dedup_insert_slot(table, i);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Reads up to 'len' bytes at 'offset' of 'fd' into 'buf', zero-filling
+ * whatever lies past the end of the file.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int read_fully_at(int fd, char *buf, size_t len, off_t offset) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t n = pread(fd, buf + total, len - total, offset + total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            memset(buf + total, 0, len - total);
+            break;
+        }
+        total += n;
+    }
+    return 0;
+}
+
+/*
+ * Compares the first 'size' bytes of the file 'entry' was archived from with
+ * 'payload', or with 'fd' if that is NULL.
+ * Returns 1 if they are equal, 0 if they differ or the file has changed
+ * since it was archived, or -1 if an error occurs
+ */
+static int same_contents(const dedup_entry_t *entry, size_t size, int fd, const char *payload) {
+    int entry_fd = open(entry->name, O_RDONLY | O_CLOEXEC);
+    if (entry_fd < 0) {
+        return 0;    // Gone since it was archived; not a usable link target
+    }
+    struct stat stat_buf;
+    if (fstat(entry_fd, &stat_buf) != 0 || stat_buf.st_dev != entry->dev ||
+        stat_buf.st_ino != entry->ino || (uint64_t) stat_buf.st_size != entry->size ||
+        stat_buf.st_mtim.tv_sec != entry->mtime_sec ||
+        stat_buf.st_mtim.tv_nsec != entry->mtime_nsec) {
+        close(entry_fd);
+        return 0;
+    }
+
+    char *buf = malloc(2 * DEDUP_BUF_LEN);
+    if (buf == NULL) {
+        perror("Failed to allocate comparison buffer");
+        close(entry_fd);
+        return -1;
+    }
+    int result = 1;
+    for (size_t done = 0; done < size && result == 1; done += DEDUP_BUF_LEN) {
+        size_t want = size - done < DEDUP_BUF_LEN ? size - done : DEDUP_BUF_LEN;
+        const char *data = buf + DEDUP_BUF_LEN;
+        if (payload != NULL) {
+            data = payload + done;
+        } else if (read_fully_at(fd, buf + DEDUP_BUF_LEN, want, done) != 0) {
+            perror("Error reading from file");
+            result = -1;
+            break;
+        }
+        if (read_fully_at(entry_fd, buf, want, done) != 0) {
+            perror("Error reading from file");
+            result = -1;
+        } else if (memcmp(buf, data, want) != 0) {
+            result = 0;
+        }
+    }
+    free(buf);
+    close(entry_fd);
+    return result;
+}
+
+void dedup_table_init(dedup_table_t *table) {
+    table->entries = NULL;
+    table->count = 0;
+    table->capacity = 0;
+    table->slots = NULL;
+    table->num_slots = 0;
+}
+
+void dedup_table_free(dedup_table_t *table) {
+    for (size_t i = 0; i < table->count; i++) {
+        free(table->entries[i].name);
+    }
+    free(table->entries);
+    free(table->slots);
+    dedup_table_init(table);
+}
+
+uint32_t dedup_digest(const char *data, size_t len) {
+    return dedup_digest_update(DEDUP_DIGEST_INIT, data, len);
+}
+
+uint32_t dedup_digest_update(uint32_t digest, const char *data, size_t len) {
+    uLong crc = digest;
+    // crc32 takes a uInt length, so very large buffers go in pieces
+    while (len > 0) {
+        uInt n = len > (1U << 30) ? (1U << 30) : (uInt) len;
+        crc = crc32(crc, (const Bytef *) data, n);
+        data += n;
+        len -= n;
+    }
+    return crc;
+}
+
+int dedup_digest_fd(int fd, size_t size, uint32_t *digest) {
+    char *buf = malloc(DEDUP_BUF_LEN);
+    if (buf == NULL) {
+        perror("Failed to allocate digest buffer");
+        return -1;
+    }
+    uLong crc = crc32(0L, Z_NULL, 0);
+    for (size_t done = 0; done < size; done += DEDUP_BUF_LEN) {
+        size_t want = size - done < DEDUP_BUF_LEN ? size - done : DEDUP_BUF_LEN;
+        if (read_fully_at(fd, buf, want, done) != 0) {
+            perror("Error reading from file");
+            free(buf);
+            return -1;
+        }
+        crc = crc32(crc, (const Bytef *) buf, want);
+    }
+    free(buf);
+    *digest = crc;
+    return 0;
+}
+
+int dedup_find(const dedup_table_t *table, const char *name, const struct stat *stat_buf,
+               size_t size, uint32_t digest, int fd, const char *payload,
+               const char **target) {
+    *target = NULL;
+    if (table->num_slots == 0) {
+        return 0;
+    }
+    size_t mask = table->num_slots - 1;
+    size_t slot = dedup_hash(size, digest) & mask;
+    for (; table->slots[slot] != 0; slot = (slot + 1) & mask) {
+        const dedup_entry_t *entry = &table->entries[table->slots[slot] - 1];
+        if (entry->size != size || entry->digest != digest || strcmp(entry->name, name) == 0) {
+            continue;
+        }
+        // Another name for the very same unchanged file needs no comparison
+        if (entry->dev == (uint64_t) stat_buf->st_dev &&
+            entry->ino == (uint64_t) stat_buf->st_ino &&
+            entry->mtime_sec == stat_buf->st_mtim.tv_sec &&
+            entry->mtime_nsec == stat_buf->st_mtim.tv_nsec) {
+            *target = entry->name;
+            return 0;
+        }
+        int same = same_contents(entry, size, fd, payload);
+        if (same != 0) {
+            if (same == 1) {
+                *target = entry->name;
+            }
+            return same == 1 ? 0 : -1;
+        }
+    }
+    return 0;
+}
+
+int dedup_add(dedup_table_t *table, const char *name, const struct stat *stat_buf,
+              size_t size, uint32_t digest) {
+    if (dedup_reserve(table) != 0) {
+        return -1;
+    }
+    dedup_entry_t *entry = &table->entries[table->count];
+    entry->name = strdup(name);
+    if (entry->name == NULL) {
+        perror("Failed to add member to dedup table");
+        return -1;
+    }
+    entry->size = size;
+    entry->digest = digest;
+    entry->dev = stat_buf->st_dev;
+    entry->ino = stat_buf->st_ino;
+    entry->mtime_sec = stat_buf->st_mtim.tv_sec;
+    entry->mtime_nsec = stat_buf->st_mtim.tv_nsec;
+    dedup_insert_slot(table, table->count);
+    table->count++;
+    return 0;
+}
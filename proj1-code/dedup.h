@@ -0,0 +1,80 @@
+#ifndef _DEDUP_H
+#define _DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// A regular member already written in full, which later copies can link to
+typedef struct {
+    // Member name, which is also the path its data was read from
+    char *name;
+    uint64_t size;
+    uint32_t digest;
+    // Identity of the file when it was archived, to tell whether it has
+    // changed since before its contents are compared again
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} dedup_entry_t;
+
+// Contents of the regular members written during one archive operation
+typedef struct {
+    dedup_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    // Open-addressing hash table on (size, digest) holding (entry position + 1),
+    // 0 marking a free slot
+    size_t *slots;
+    size_t num_slots;
+} dedup_table_t;
+
+// Initialize a new, empty table
+void dedup_table_init(dedup_table_t *table);
+
+// Free all memory associated with the table and reset it to empty
+void dedup_table_free(dedup_table_t *table);
+
+// Returns the content digest of the 'len' bytes at 'data'
+uint32_t dedup_digest(const char *data, size_t len);
+
+// Digest of no data, to be extended a chunk at a time with dedup_digest_update
+#define DEDUP_DIGEST_INIT 0
+
+// Returns 'digest' extended with the 'len' bytes at 'data'
+uint32_t dedup_digest_update(uint32_t digest, const char *data, size_t len);
+
+/*
+ * Compute the content digest of the first 'size' bytes of the open file
+ * 'fd' into '*digest', reading with pread so the file offset is unchanged.
+ * Bytes past the end of a file that shrank count as zeros, as they are
+ * archived.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int dedup_digest_fd(int fd, size_t size, uint32_t *digest);
+
+/*
+ * Look for an earlier member with the same contents as the member 'name',
+ * read from the file described by 'stat_buf', whose first 'size' bytes have
+ * digest 'digest' and are held in 'payload' or, if that is NULL, read from
+ * 'fd'. A candidate with the same size and digest is confirmed byte by byte
+ * against the file it was archived from, and skipped if that file has
+ * changed since. An earlier member called 'name' is never chosen, since a
+ * link cannot refer to its own name.
+ * Sets '*target' to the earlier member's name, or NULL if there is none.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int dedup_find(const dedup_table_t *table, const char *name, const struct stat *stat_buf,
+               size_t size, uint32_t digest, int fd, const char *payload,
+               const char **target);
+
+/*
+ * Remember the member 'name', written in full from the file described by
+ * 'stat_buf', whose first 'size' bytes have digest 'digest'.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int dedup_add(dedup_table_t *table, const char *name, const struct stat *stat_buf,
+              size_t size, uint32_t digest);
+
+#endif    // _DEDUP_H
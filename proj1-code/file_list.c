@@ -2,53 +2,161 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "file_list.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define INITIAL_NUM_SLOTS 16
+// Chunks start small so short lists stay cheap, then double up to the max
+#define MIN_CHUNK_SIZE 4096
+#define MAX_CHUNK_SIZE (1 << 20)
+#define CHUNK_ALIGN 16
+
+struct list_chunk {
+    struct list_chunk *next;
+    size_t used;
+    size_t capacity;
+    _Alignas(CHUNK_ALIGN) char data[];
+};
+
+uint64_t file_list_hash(const char *file_name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *) file_name; *p != '\0'; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * Carves 'size' bytes out of the list's newest chunk, starting a new chunk
+ * when it is full. Returns NULL if memory could not be allocated.
+ */
+static void *list_alloc(file_list_t *list, size_t size) {
+    size = (size + CHUNK_ALIGN - 1) & ~(size_t) (CHUNK_ALIGN - 1);
+    struct list_chunk *chunk = list->chunks;
+    if (chunk == NULL || chunk->capacity - chunk->used < size) {
+        size_t capacity = chunk == NULL ? MIN_CHUNK_SIZE : chunk->capacity * 2;
+        if (capacity > MAX_CHUNK_SIZE) {
+            capacity = MAX_CHUNK_SIZE;
+        }
+        if (capacity < size) {
+            capacity = size;
+        }
+        chunk = malloc(sizeof(struct list_chunk) + capacity);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = list->chunks;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        list->chunks = chunk;
+    }
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+size_t file_list_name_len(const char *name) {
+    uint32_t len;
+    memcpy(&len, name - sizeof(len), sizeof(len));
+    return len;
+}
+
+// Returns the slot holding 'file_name', or the free slot where it would go
+static node_t **find_slot(node_t **slots, size_t num_slots, const char *file_name,
+                          size_t len) {
+    size_t mask = num_slots - 1;
+    size_t i = file_list_hash(file_name) & mask;
+    // Comparing the stored length first rejects most mismatches without touching the text
+    while (slots[i] != NULL && (file_list_name_len(slots[i]->name) != len ||
+                                memcmp(slots[i]->name, file_name, len) != 0)) {
+        i = (i + 1) & mask;
+    }
+    return &slots[i];
+}
+
+// Doubles the hash table once it is half full; returns 0 on success or 1 on error
+static int grow_slots(file_list_t *list) {
+    if ((size_t) (list->size + 1) * 2 <= list->num_slots) {
+        return 0;
+    }
+    size_t num_slots = list->num_slots == 0 ? INITIAL_NUM_SLOTS : list->num_slots * 2;
+    node_t **slots = calloc(num_slots, sizeof(node_t *));
+    if (slots == NULL) {
+        return 1;
+    }
+    for (size_t i = 0; i < list->num_slots; i++) {
+        if (list->slots[i] != NULL) {
+            const char *name = list->slots[i]->name;
+            *find_slot(slots, num_slots, name, file_list_name_len(name)) = list->slots[i];
+        }
+    }
+    free(list->slots);
+    list->slots = slots;
+    list->num_slots = num_slots;
+    return 0;
+}
+
 void file_list_init(file_list_t *list) {
     list->head = NULL;
+    list->tail = NULL;
     list->size = 0;
+    list->slots = NULL;
+    list->num_slots = 0;
+    list->chunks = NULL;
 }
 
 int file_list_add(file_list_t *list, const char *file_name) {
-    if (list->head == NULL) {
-        list->head = malloc(sizeof(node_t));
-        if (list->head == NULL) {
+    if (grow_slots(list) != 0) {
+        return 1;
+    }
+    size_t len = strlen(file_name);
+    if (len > UINT32_MAX) {
+        return 1;
+    }
+    node_t *node = list_alloc(list, sizeof(node_t));
+    if (node == NULL) {
+        return 1;
+    }
+
+    // Duplicate names keep pointing at the first node with that name and
+    // reuse its copy of the name; new names get a length-prefixed copy
+    node_t **slot = find_slot(list->slots, list->num_slots, file_name, len);
+    if (*slot != NULL) {
+        node->name = (*slot)->name;
+    } else {
+        uint32_t prefix = len;
+        char *name = list_alloc(list, sizeof(prefix) + len + 1);
+        if (name == NULL) {
             return 1;
         }
-        strncpy(list->head->name, file_name, MAX_NAME_LEN);
-        list->head->next = NULL;
-        list->size = 1;
-        return 0;
+        memcpy(name, &prefix, sizeof(prefix));
+        memcpy(name + sizeof(prefix), file_name, len + 1);
+        node->name = name + sizeof(prefix);
+        *slot = node;
     }
+    node->next = NULL;
 
-    node_t *current = list->head;
-    while (current->next != NULL) {
-        current = current->next;
-    }
-    current->next = malloc(sizeof(node_t));
-    if (current->next == NULL) {
-        return 1;
+    if (list->tail == NULL) {
+        list->head = node;
+    } else {
+        list->tail->next = node;
     }
-    strncpy(current->next->name, file_name, MAX_NAME_LEN);
-    current->next->next = NULL;
+    list->tail = node;
     list->size++;
     return 0;
 }
 
 int file_list_contains(const file_list_t *list, const char *file_name) {
-    node_t *current = list->head;
-    while (current != NULL) {
-        if (strcmp(current->name, file_name) == 0) {
-            return 1;
-        }
-        current = current->next;
+    if (list->num_slots == 0) {
+        return 0;
     }
-    return 0;
+    return *find_slot(list->slots, list->num_slots, file_name, strlen(file_name)) != NULL;
 }
 
 int file_list_is_subset(const file_list_t *l1, const file_list_t *l2) {
-    // This approach is not particularly efficient
+    // Each lookup in l2 is a hash probe, so this is linear in the size of l1
     node_t *current = l1->head;
     while (current != NULL) {
         if (!file_list_contains(l2, current->name)) {
@@ -60,12 +168,12 @@ int file_list_is_subset(const file_list_t *l1, const file_list_t *l2) {
 }
 
 void file_list_clear(file_list_t *list) {
-    node_t *current = list->head;
+    struct list_chunk *current = list->chunks;
     while (current != NULL) {
-        node_t *to_free = current;
+        struct list_chunk *to_free = current;
         current = current->next;
         free(to_free);
     }
-    list->head = NULL;
-    list->size = 0;
+    free(list->slots);
+    file_list_init(list);
 }
@@ -3,18 +3,32 @@
 #ifndef _FILE_LIST_H
 #define _FILE_LIST_H
 
-#define MAX_NAME_LEN 32
+#include <stddef.h>
+#include <stdint.h>
 
 //  Definition of each node in the linked list
 typedef struct node {
-    char name[MAX_NAME_LEN];
+    // Null-terminated name stored in the list's string pool. Nodes with equal
+    // names share one copy, and the name's length is stored just before it
+    const char *name;
     struct node *next;
 } node_t;
 
+// Contiguous block of memory that nodes and names are carved from (defined in file_list.c)
+struct list_chunk;
+
 // Linked list definition
 typedef struct {
     node_t *head;
+    // Last node, so that adding to the tail does not walk the list
+    node_t *tail;
     int size;
+    // Open-addressing hash table over the nodes (NULL marks a free slot),
+    // holding the first node with each distinct name
+    node_t **slots;
+    size_t num_slots;
+    // Arena of chunks backing every node and name, newest chunk first
+    struct list_chunk *chunks;
 } file_list_t;
 
 // Initialize a new, empty list
@@ -25,12 +39,19 @@ void file_list_init(file_list_t *list);
 int file_list_add(file_list_t *list, const char *file_name);
 
 // Remove all entries from the list and free any memory associated with them
+// Node and name memory is released a whole chunk at a time
 void file_list_clear(file_list_t *list);
 
 // Determine if a file name is contained in a list
 // Returns 1 if the name is present as an element in the list, 0 otherwise
 int file_list_contains(const file_list_t *list, const char *file_name);
 
+// Length of a name stored in a list node, read from its length prefix
+size_t file_list_name_len(const char *name);
+
+// 64-bit FNV-1a hash of a file name, used to index names in hash tables
+uint64_t file_list_hash(const char *file_name);
+
 // Determine if the elements of l1 are a subset of the elements of l2
 // That is, all elements of l1 are contained in l2
 // Returns 1 if l1 is a subset of l2, 0 otherwise
@@ -1,42 +1,108 @@
+#define _GNU_SOURCE
 #include "minitar.h"
+#include "archive_index.h"
+#include "block_ops.h"
+#include "compress.h"
+#include "parallel.h"
+#include "snapshot.h"
+#include "walk.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define NUM_TRAILING_BLOCKS 2
 #define MAX_MSG_LEN 128
-#define BLOCK_SIZE 512
+// Initial scratch space for getpwuid_r/getgrgid_r results when sysconf gives
+// no size hint; it doubles for as long as the lookup reports ERANGE
+#define NSS_BUF_LEN 4096
+// Initial number of slots in an owner/group name cache, a power of 2
+#define NAME_CACHE_INITIAL_SLOTS 16
 // Constants for tar compatibility information
 #define MAGIC "ustar"
 
 // Constants to represent different file types
-// We'll only use regular files in this project
+// Regular files and the directories holding them are supported
 #define REGTYPE '0'
 #define DIRTYPE '5'
 
+// Alignment of the copy engine's staging buffer
+#define COPY_BUFFER_ALIGN 4096
+
+// Most members considered when training a compression dictionary, the most
+// bytes taken from any one of them, and the largest member considered
+// small enough to benefit from a dictionary
+#define DICTIONARY_CANDIDATES 256
+#define DICTIONARY_SAMPLE_MAX 4096
+#define SMALL_MEMBER_MAX (64 * 1024)
+
+// Bytes of a file read at a time when comparing it with an archive member
+#define COMPARE_BUF_LEN (64 * 1024)
+
+minitar_options_t minitar_options = {
+    .copy_chunk_size = DEFAULT_COPY_CHUNK_SIZE,
+    .zero_copy = 0,
+    .use_index = 0,
+    .num_threads = 1,
+    .preallocate = 0,
+    .compress = 0,
+    .seekable = 0,
+    .dictionary = 0,
+    .numeric_owner = 0,
+    .compare_content = 0,
+    .snapshot_file = NULL,
+    .incremental_extract = 0,
+    .dedup = 0,
+};
+
 /*
  * Helper function to compute the checksum of a tar header block
- * Performs a simple sum over all bytes in the header in accordance with POSIX
- * standard for tar file structure.
+ * Performs a simple sum over all bytes in the header, taken as unsigned
+ * values, in accordance with POSIX standard for tar file structure.
  */
 void compute_checksum(tar_header *header) {
     // Have to initially set header's checksum to "all blanks"
     memset(header->chksum, ' ', 8);
-    unsigned sum = 0;
-    char *bytes = (char *) header;
-    for (int i = 0; i < BLOCK_SIZE; i++) {
-        sum += bytes[i];
+    snprintf(header->chksum, 8, "%07o", header_checksum(header));
+}
+
+/*
+ * Checks the checksum stored in 'header' against the header's contents.
+ * Sums over signed bytes, which some older tar programs wrote, also match.
+ * Returns 1 if the checksum matches, 0 otherwise
+ */
+int verify_checksum(const tar_header *header) {
+    unsigned long long stored = parse_octal(header->chksum, sizeof(header->chksum));
+    unsigned sum = header_checksum(header);
+    if (stored == sum) {
+        return 1;
     }
-    snprintf(header->chksum, 8, "%07o", sum);
+
+    // Rare slow path: as signed values, bytes of 0x80 and up count 256 less
+    const unsigned char *bytes = (const unsigned char *) header;
+    unsigned high_bytes = 0;
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        if (i < offsetof(tar_header, chksum) ||
+            i >= offsetof(tar_header, chksum) + sizeof(header->chksum)) {
+            high_bytes += bytes[i] >= 0x80;
+        }
+    }
+    return high_bytes > 0 && stored == sum - 256 * high_bytes;
 }
 
 /* Helper Function to check if a block is completely empty (all zeroes)
@@ -45,12 +111,251 @@ int is_empty_block(const char *block) {
     if (block == NULL) {
         return 0;    // Or handle the error as appropriate
     }
-    for (int i = 0; i < BLOCK_SIZE; i++) {
-        if (block[i] != '\0') {
-            return 0;    // Block is not empty
+    return zero_block_run(block, 1) == 1;
+}
+
+/*
+ * Stores 'file_name' in the header's name field. Paths longer than the 100-byte
+ * name field are split at a '/' with the leading directories moved into the
+ * 155-byte prefix field, as the ustar format allows.
+ * The header must already be zeroed.
+ * Returns 0 on success or -1 if the path cannot be represented
+ */
+int set_member_name(tar_header *header, const char *file_name) {
+    size_t len = strlen(file_name);
+    if (len <= sizeof(header->name)) {
+        memcpy(header->name, file_name, len);
+        return 0;
+    }
+
+    // Use the rightmost '/' that leaves a prefix short enough for its field
+    size_t split = len - 1 < sizeof(header->prefix) ? len - 1 : sizeof(header->prefix);
+    for (; split > 0 && len - split - 1 <= sizeof(header->name); split--) {
+        if (file_name[split] == '/') {
+            memcpy(header->prefix, file_name, split);
+            memcpy(header->name, file_name + split + 1, len - split - 1);
+            return 0;
+        }
+    }
+    fprintf(stderr, "Error: File name %s is too long for a tar header\n", file_name);
+    // Callers report the failure with perror, which would otherwise show a stale errno
+    errno = ENAMETOOLONG;
+    return -1;
+}
+
+// A user or group name cached under its numeric ID
+typedef struct {
+    unsigned id;
+    int used;
+    char name[32];
+} name_cache_slot_t;
+
+// Open-addressing table of the names looked up so far for one kind of ID
+typedef struct {
+    name_cache_slot_t *slots;
+    size_t capacity;
+    size_t count;
+} name_cache_t;
+
+// Names stay cached for the whole run; worker threads share them through the lock
+static name_cache_t user_names;
+static name_cache_t group_names;
+static pthread_mutex_t name_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t name_cache_slot(unsigned id, size_t capacity) {
+    // Fibonacci hashing spreads consecutive IDs over the table
+    return (size_t) ((id * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
+
+/*
+ * Copies the name cached under 'id' into 'name' (32 bytes).
+ * Must be called with name_cache_lock held.
+ * Returns 1 if the name was cached, 0 otherwise
+ */
+static int name_cache_find(const name_cache_t *cache, unsigned id, char *name) {
+    if (cache->capacity == 0) {
+        return 0;
+    }
+    for (size_t slot = name_cache_slot(id, cache->capacity); cache->slots[slot].used;
+         slot = (slot + 1) & (cache->capacity - 1)) {
+        if (cache->slots[slot].id == id) {
+            memcpy(name, cache->slots[slot].name, sizeof(cache->slots[slot].name));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Caches 'name' (32 bytes) under 'id', growing the table to keep it at most
+ * half full. Must be called with name_cache_lock held.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int name_cache_insert(name_cache_t *cache, unsigned id, const char *name) {
+    if (2 * (cache->count + 1) > cache->capacity) {
+        size_t capacity = cache->capacity == 0 ? NAME_CACHE_INITIAL_SLOTS : 2 * cache->capacity;
+        name_cache_slot_t *slots = calloc(capacity, sizeof(name_cache_slot_t));
+        if (slots == NULL) {
+            perror("Failed to allocate name cache");
+            return -1;
+        }
+        for (size_t i = 0; i < cache->capacity; i++) {
+            if (cache->slots[i].used) {
+                size_t slot = name_cache_slot(cache->slots[i].id, capacity);
+                while (slots[slot].used) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                slots[slot] = cache->slots[i];
+            }
+        }
+        free(cache->slots);
+        cache->slots = slots;
+        cache->capacity = capacity;
+    }
+
+    size_t slot = name_cache_slot(id, cache->capacity);
+    while (cache->slots[slot].used) {
+        if (cache->slots[slot].id == id) {
+            return 0;    // Another thread looked it up first
+        }
+        slot = (slot + 1) & (cache->capacity - 1);
+    }
+    cache->slots[slot].id = id;
+    cache->slots[slot].used = 1;
+    memcpy(cache->slots[slot].name, name, sizeof(cache->slots[slot].name));
+    cache->count++;
+    return 0;
+}
+
+/*
+ * Looks up the name of user ID 'uid' (if 'is_group' is 0) or group ID 'gid'
+ * (otherwise) and stores it in 'name' (32 bytes, null-padded), asking NSS
+ * only the first time each ID is seen.
+ * Returns 0 on success or -1 with errno set if the ID has no name or an
+ * error occurs
+ */
+static int lookup_owner_name(unsigned id, int is_group, char *name) {
+    name_cache_t *cache = is_group ? &group_names : &user_names;
+    pthread_mutex_lock(&name_cache_lock);
+    int found = name_cache_find(cache, id, name);
+    pthread_mutex_unlock(&name_cache_lock);
+    if (found) {
+        return 0;
+    }
+
+    // The reentrant lookups let worker threads fill headers concurrently;
+    // they run outside the lock so a slow directory service stalls only this thread
+    long size_hint = sysconf(is_group ? _SC_GETGR_R_SIZE_MAX : _SC_GETPW_R_SIZE_MAX);
+    size_t nss_len = size_hint > 0 ? (size_t) size_hint : NSS_BUF_LEN;
+    char *nss_buf = NULL;
+    struct group grp_buf;
+    struct group *grp = NULL;
+    struct passwd pwd_buf;
+    struct passwd *pwd = NULL;
+    int err;
+    do {
+        char *grown = realloc(nss_buf, nss_len);
+        if (grown == NULL) {
+            free(nss_buf);
+            return -1;
+        }
+        nss_buf = grown;
+        if (is_group) {
+            err = getgrgid_r(id, &grp_buf, nss_buf, nss_len, &grp);
+        } else {
+            err = getpwuid_r(id, &pwd_buf, nss_buf, nss_len, &pwd);
+        }
+        nss_len *= 2;
+    } while (err == ERANGE);
+
+    // The lookups return their error rather than setting errno; an ID
+    // without an entry returns 0 and no result
+    memset(name, 0, 32);
+    if (err == 0 && (is_group ? grp == NULL : pwd == NULL)) {
+        err = ENOENT;
+    }
+    if (err == 0) {
+        strncpy(name, is_group ? grp->gr_name : pwd->pw_name, 32);
+    }
+    free(nss_buf);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    pthread_mutex_lock(&name_cache_lock);
+    int result = name_cache_insert(cache, id, name);
+    pthread_mutex_unlock(&name_cache_lock);
+    return result;
+}
+
+void owner_name_cache_clear(void) {
+    pthread_mutex_lock(&name_cache_lock);
+    name_cache_t *caches[] = {&user_names, &group_names};
+    for (int i = 0; i < 2; i++) {
+        free(caches[i]->slots);
+        caches[i]->slots = NULL;
+        caches[i]->capacity = 0;
+        caches[i]->count = 0;
+    }
+    pthread_mutex_unlock(&name_cache_lock);
+}
+
+/*
+ * Populates a tar header block pointed to by 'header' with the metadata in
+ * 'stat_buf', which describes the file identified by 'file_name'.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int fill_tar_header_from_stat(tar_header *header, const char *file_name,
+                                     const struct stat *stat_buf) {
+    memset(header, 0, BLOCK_SIZE);
+    char err_msg[MAX_MSG_LEN];
+    int is_dir = S_ISDIR(stat_buf->st_mode);
+
+    // Directory names carry a trailing '/', as other tar programs write them
+    const char *member_name = file_name;
+    char dir_name[MEMBER_NAME_BUF_LEN + 1];
+    if (is_dir && file_name[strlen(file_name) - 1] != '/') {
+        snprintf(dir_name, sizeof(dir_name), "%s/", file_name);
+        member_name = dir_name;
+    }
+    if (set_member_name(header, member_name) != 0) {    // Name (and prefix) of the file
+        return -1;
+    }
+    snprintf(header->mode, 8, "%07o",
+             stat_buf->st_mode & 07777);    // Permissions for file, 0-padded octal
+
+    snprintf(header->uid, 8, "%07o", stat_buf->st_uid);    // Owner ID of the file, 0-padded octal
+    snprintf(header->gid, 8, "%07o", stat_buf->st_gid);    // Group ID of the file, 0-padded octal
+    if (!minitar_options.numeric_owner) {
+        // Owner and group names of the file, null-terminated strings
+        if (lookup_owner_name(stat_buf->st_uid, 0, header->uname) != 0) {
+            snprintf(err_msg, MAX_MSG_LEN, "Failed to look up owner name of file %s", file_name);
+            perror(err_msg);
+            return -1;
+        }
+        if (lookup_owner_name(stat_buf->st_gid, 1, header->gname) != 0) {
+            snprintf(err_msg, MAX_MSG_LEN, "Failed to look up group name of file %s", file_name);
+            perror(err_msg);
+            return -1;
         }
     }
-    return 1;    // Block is empty
+
+    if (set_member_size(header, is_dir ? 0 : stat_buf->st_size) != 0) {    // File size
+        return -1;
+    }
+    snprintf(header->mtime, 12, "%011o",
+             (unsigned) stat_buf->st_mtime);    // Modification time, 0-padded octal
+    header->typeflag = is_dir ? DIRTYPE : REGTYPE;    // File type, regular file or directory
+    strncpy(header->magic, MAGIC, 6);                 // Special, standardized sequence of bytes
+    memcpy(header->version, "00", 2);                 // A bit weird, sidesteps null termination
+    snprintf(header->devmajor, 8, "%07o",
+             major(stat_buf->st_dev));    // Major device number, 0-padded octal
+    snprintf(header->devminor, 8, "%07o",
+             minor(stat_buf->st_dev));    // Minor device number, 0-padded octal
+
+    compute_checksum(header);
+    return 0;
 }
 
 /*
@@ -59,7 +364,6 @@ int is_empty_block(const char *block) {
  * Returns 0 on success or -1 if an error occurs
  */
 int fill_tar_header(tar_header *header, const char *file_name) {
-    memset(header, 0, BLOCK_SIZE);
     char err_msg[MAX_MSG_LEN];
     struct stat stat_buf;
     // stat is a system call to inspect file metadata
@@ -68,43 +372,36 @@ int fill_tar_header(tar_header *header, const char *file_name) {
         perror(err_msg);
         return -1;
     }
+    return fill_tar_header_from_stat(header, file_name, &stat_buf);
+}
 
-    strncpy(header->name, file_name, 100);    // Name of the file, null-terminated string
-    snprintf(header->mode, 8, "%07o",
-             stat_buf.st_mode & 07777);    // Permissions for file, 0-padded octal
-
-    snprintf(header->uid, 8, "%07o", stat_buf.st_uid);    // Owner ID of the file, 0-padded octal
-    struct passwd *pwd = getpwuid(stat_buf.st_uid);       // Look up name corresponding to owner ID
-    if (pwd == NULL) {
-        snprintf(err_msg, MAX_MSG_LEN, "Failed to look up owner name of file %s", file_name);
+int open_member(const char *file_name, int fd, tar_header *header, struct stat *stat_out) {
+    char err_msg[MAX_MSG_LEN];
+    // The directory walk leaves each command-line name open
+    if (fd < 0) {
+        fd = open(file_name, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to open file %s", file_name);
         perror(err_msg);
         return -1;
     }
-    strncpy(header->uname, pwd->pw_name, 32);    // Owner name of the file, null-terminated string
-
-    snprintf(header->gid, 8, "%07o", stat_buf.st_gid);    // Group ID of the file, 0-padded octal
-    struct group *grp = getgrgid(stat_buf.st_gid);        // Look up name corresponding to group ID
-    if (grp == NULL) {
-        snprintf(err_msg, MAX_MSG_LEN, "Failed to look up group name of file %s", file_name);
+    // fstat describes exactly the file that was opened, with no second path lookup
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) != 0) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to stat file %s", file_name);
         perror(err_msg);
+        close(fd);
         return -1;
     }
-    strncpy(header->gname, grp->gr_name, 32);    // Group name of the file, null-terminated string
-
-    snprintf(header->size, 12, "%011o",
-             (unsigned) stat_buf.st_size);    // File size, 0-padded octal
-    snprintf(header->mtime, 12, "%011o",
-             (unsigned) stat_buf.st_mtime);    // Modification time, 0-padded octal
-    header->typeflag = REGTYPE;                // File type, always regular file in this project
-    strncpy(header->magic, MAGIC, 6);          // Special, standardized sequence of bytes
-    memcpy(header->version, "00", 2);          // A bit weird, sidesteps null termination
-    snprintf(header->devmajor, 8, "%07o",
-             major(stat_buf.st_dev));    // Major device number, 0-padded octal
-    snprintf(header->devminor, 8, "%07o",
-             minor(stat_buf.st_dev));    // Minor device number, 0-padded octal
-
-    compute_checksum(header);
-    return 0;
+    if (fill_tar_header_from_stat(header, file_name, &stat_buf) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (stat_out != NULL) {
+        *stat_out = stat_buf;
+    }
+    return fd;
 }
 
 /*
@@ -137,423 +434,2369 @@ int remove_trailing_bytes(const char *file_name, size_t nbytes) {
     return 0;
 }
 
-int create_archive(const char *archive_name, const file_list_t *files) {
-    // Open the archive file for writing (overwrite if it exists)
-    FILE *archive_fp = fopen(archive_name, "wb");
-    if (!archive_fp) {
-        perror("Error: Failed to open archive file for writing");
-        return -1;
+/*
+ * Allocates the staging buffer used by the member copy engine.
+ * 'chunk_size' is rounded up to a whole number of BLOCK_SIZE blocks so that
+ * every chunk except the last one lands on a block boundary in the archive.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int copy_engine_init(copy_engine_t *engine, size_t chunk_size) {
+    if (chunk_size < BLOCK_SIZE) {
+        chunk_size = BLOCK_SIZE;
     }
+    chunk_size = (chunk_size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
 
-    // Iterating through each file in the linked list
-    const node_t *current = files->head;
-    while (current != NULL) {
-        FILE *file_fp = fopen(current->name, "rb");
-        if (!file_fp) {
-            perror("Error: Failed to open member file");
-            if (fclose(archive_fp) != 0) {    // checking if file actually closed
-                printf("Error closing file.");
-                return -1;
-            }
-            return -1;
-        }
+    // Page-aligned so large reads and writes can be serviced without bouncing
+    engine->buffer = aligned_alloc(COPY_BUFFER_ALIGN,
+                                   (chunk_size + COPY_BUFFER_ALIGN - 1) / COPY_BUFFER_ALIGN *
+                                       COPY_BUFFER_ALIGN);
+    if (engine->buffer == NULL) {
+        perror("Failed to allocate copy buffer");
+        return -1;
+    }
+    engine->chunk_size = chunk_size;
+    engine->copy_file_range_failed = 0;
+    engine->sendfile_failed = 0;
+    engine->num_copy_file_range = 0;
+    engine->num_sendfile = 0;
+    engine->num_buffered = 0;
+    dedup_table_init(&engine->dedup);
+    engine->dedup_after_copy = 0;
+    engine->num_dedup_links = 0;
+    engine->dedup_bytes = 0;
+    return 0;
+}
 
-        // Create and populate the tar header
-        tar_header header;
-        if (fill_tar_header(&header, current->name) != 0) {
-            perror("Error: Failed to create tar header");
-            if (fclose(file_fp) != 0) {
-                printf("Error closing file.");
-                return -1;
-            }
-            if (fclose(archive_fp) != 0) {
-                printf("Error closing file.");
-                return -1;
-            }
-            return -1;
-        }
+// Releases the staging buffer and dedup table owned by 'engine'
+void copy_engine_free(copy_engine_t *engine) {
+    free(engine->buffer);
+    engine->buffer = NULL;
+    engine->chunk_size = 0;
+    dedup_table_free(&engine->dedup);
+}
 
-        // Write the header to the archive
-        if (fwrite(&header, BLOCK_SIZE, 1, archive_fp) != 1) {
-            perror("Error: Failed to write header to archive");
-            if (fclose(file_fp) != 0) {
-                printf("Error closing file.");
-                return -1;
-            }
-            if (fclose(archive_fp) != 0) {
-                printf("Error closing file.");
-                return -1;
+/*
+ * Streams 'size' bytes of member data from 'src_fd' into 'dst' using chunks
+ * of engine->chunk_size bytes. Only the final, partially filled chunk is
+ * padded with zeros, and only up to the next BLOCK_SIZE boundary. Bytes a
+ * growing file gained after its header was filled are left out, and a file
+ * that shrank is zero-filled, so the data always matches the header's size.
+ * Unless 'digest' is NULL, the dedup digest of the data is computed on the
+ * way and stored there.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int copy_member_data(copy_engine_t *engine, int src_fd, FILE *dst, size_t size,
+                     uint32_t *digest) {
+    uint32_t data_digest = DEDUP_DIGEST_INIT;
+    size_t remaining = size;
+    while (remaining > 0) {
+        size_t want = remaining < engine->chunk_size ? remaining : engine->chunk_size;
+        size_t bytes_read = 0;
+        while (bytes_read < want) {
+            ssize_t n = read(src_fd, engine->buffer + bytes_read, want - bytes_read);
+            if (n < 0 && errno == EINTR) {
+                continue;
             }
-            return -1;
-        }
-
-        // Write the file contents to the archive in 512-byte blocks
-        char buffer[512] = {0};
-        size_t bytes_read;
-        while ((bytes_read = fread(buffer, 1, sizeof(buffer), file_fp)) > 0) {
-            if (ferror(file_fp)) {
+            if (n < 0) {
                 perror("Error reading from file");
-            }
-            // Pad the last block with zeros
-            if (bytes_read < sizeof(buffer)) {
-                memset(buffer + bytes_read, 0, sizeof(buffer) - bytes_read);
-            }
-
-            // Writing the block to the archive
-            if (fwrite(buffer, sizeof(buffer), 1, archive_fp) != 1) {
-                perror("Error: Failed to write file contents to archive");
-                if (fclose(file_fp) != 0) {
-                    printf("Error closing file.");
-                    return -1;
-                }
-                if (fclose(archive_fp) != 0) {
-                    printf("Error closing file.");
-                    return -1;
-                }
                 return -1;
             }
+            if (n == 0) {
+                break;
+            }
+            bytes_read += n;
         }
 
-        if (fclose(file_fp) != 0) {
-            printf("Error closing file.");
-            return -1;
+        // Zero-fill a short read and pad the last block with zeros
+        size_t padded = (want + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        memset(engine->buffer + bytes_read, 0, padded - bytes_read);
+        if (digest != NULL) {
+            data_digest = dedup_digest_update(data_digest, engine->buffer, want);
         }
-        current = current->next;
-    }
 
-    // 2 tar footers made of zeroes.
-    char zeros[512] = {0};
-    for (int i = 0; i < 2; i++) {
-        if (fwrite(zeros, sizeof(zeros), 1, archive_fp) != 1) {
-            perror("Error: Failed to write footer to archive");
-            if (fclose(archive_fp) != 0) {
-                printf("Error closing file.");
-                return -1;
-            }
+        if (fwrite(engine->buffer, 1, padded, dst) != padded) {
+            perror("Error: Failed to write file contents to archive");
             return -1;
         }
+        remaining -= want;
     }
-
-    if (fclose(archive_fp) != 0) {
-        printf("Error closing file.");
-        return -1;
+    if (digest != NULL) {
+        *digest = data_digest;
     }
     return 0;
 }
 
-int append_files_to_archive(const char *archive_name, const file_list_t *files) {
-    if (remove_trailing_bytes(archive_name, 2 * 512) != 0) {
-        perror("Could not remove the 2 archive footers.");
-        return -1;
-    }
+/*
+ * Determines whether a failed copy_file_range/sendfile call means the kernel
+ * or filesystem cannot do in-kernel copies between these descriptors, as
+ * opposed to a genuine I/O error.
+ */
+int is_zero_copy_unsupported(int err) {
+    return err == ENOSYS || err == EINVAL || err == EXDEV || err == EOPNOTSUPP ||
+           err == EBADF || err == ETXTBSY;
+}
 
-    FILE *archive_fpointer = fopen(archive_name, "a");
-    if (!archive_fpointer) {
-        perror("Error with archive file opening.");
-        return -1;
-    }
-    // let Dhayalan continue with this
-    // Iterating through each file in the linked list
-    if (fseek(archive_fpointer, 0, SEEK_END) != 0) {
-        perror("Error seeking to end of current archive file.");
-        if (fclose(archive_fpointer) != 0) {
-            printf("Error closing file.");
-            return -1;
-        }
+/*
+ * Moves 'size' bytes of member data from 'src_fd' to 'dst' inside the kernel,
+ * trying copy_file_range first and sendfile second, then zero-pads the
+ * final block from user space.
+ * Returns 0 on success, 1 if neither primitive is usable before any data was
+ * moved (the caller should use the buffered path), or -1 if an error occurs
+ */
+int copy_member_data_in_kernel(copy_engine_t *engine, int src_fd, FILE *dst, off_t size) {
+    // Hand any bytes stdio is holding for 'dst' to the kernel before bypassing it
+    if (fflush(dst) != 0) {
+        perror("Error: Failed to flush archive");
         return -1;
     }
+    int dst_fd = fileno(dst);
 
-    const node_t *current = files->head;
-    while (current != NULL) {
-        FILE *file_fp = fopen(current->name, "rb");
-        // printf("%s\n", current->name);
-
-        if (!file_fp) {
-            perror("Error: Failed to open member file");
-            if (fclose(archive_fpointer) != 0) {    // checking if file actually closed
-                printf("Error closing file.");
-                return -1;
-            }
-            return -1;
-        }
-        //  next two lines create and write a tar header.
-        tar_header header;
-        if (fill_tar_header(&header, current->name) != 0) {
-            perror("Error: Failed to create tar header");
-            if (fclose(file_fp) != 0) {
-                printf("Error closing file.");
-                return -1;
+    off_t remaining = size;
+    int used_sendfile = 0;
+    while (remaining > 0) {
+        ssize_t copied = -1;
+        if (!engine->copy_file_range_failed) {
+            copied = copy_file_range(src_fd, NULL, dst_fd, NULL, remaining, 0);
+            if (copied < 0 && is_zero_copy_unsupported(errno) && remaining == size) {
+                engine->copy_file_range_failed = 1;
+                continue;
             }
-            if (fclose(archive_fpointer) != 0) {
-                printf("Error closing file.");
-                return -1;
+        } else if (!engine->sendfile_failed) {
+            copied = sendfile(dst_fd, src_fd, NULL, remaining);
+            if (copied < 0 && is_zero_copy_unsupported(errno) && remaining == size) {
+                engine->sendfile_failed = 1;
+                continue;
             }
-            return -1;
+            used_sendfile = copied > 0;
+        } else {
+            return 1;
         }
 
-        if (fwrite(&header, 512, 1, archive_fpointer) != 1) {
-            perror("Error: Failed to write file contents to archive");
-            if (fclose(file_fp) != 0) {
-                printf("Error closing file.");
-                return -1;
-            }
-            if (fclose(archive_fpointer) != 0) {
-                printf("Error closing file.");
-                return -1;
+        if (copied < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            perror("Error: Failed to copy file contents to archive");
             return -1;
         }
-        char buffer[512] = {0};
-        size_t bytes_read;
-        while ((bytes_read = fread(buffer, 1, sizeof(buffer), file_fp)) > 0) {
-            if (ferror(file_fp)) {
-                perror("Error reading from file");
-            }
-            // Pad the last block with zeros
-            if (bytes_read < sizeof(buffer)) {
-                memset(buffer + bytes_read, 0, sizeof(buffer) - bytes_read);
-            }
-
-            // Writing the block to the archive
-            if (fwrite(buffer, sizeof(buffer), 1, archive_fpointer) != 1) {
-                perror("Error: Failed to write file contents to archive");
-                if (fclose(file_fp) != 0) {
-                    printf("Error closing file.");
-                    return -1;
-                }
-                if (fclose(archive_fpointer) != 0) {
-                    printf("Error closing file.");
-                    return -1;
-                }
-                return -1;
-            }
+        if (copied == 0) {
+            // File shrank after its header was written; zero-fill so the
+            // member still occupies exactly the size recorded in its header
+            break;
+        }
+        remaining -= copied;
     }
-    current = current->next;
-    if (fclose(file_fp) != 0) {
-        printf("Error closing file.");
+
+    // Re-synchronize the stream with the descriptor offset the kernel advanced
+    // (pipes have no offset to resynchronize)
+    off_t dst_pos = lseek(dst_fd, 0, SEEK_CUR);
+    if (dst_pos >= 0 && fseeko(dst, dst_pos, SEEK_SET) != 0) {
+        perror("Error: Failed to seek in archive");
         return -1;
     }
-}
 
-char zeros[512] = {0};
-for (int i = 0; i < 2; i++) {
-    if (fwrite(zeros, sizeof(zeros), 1, archive_fpointer) != 1) {
-        perror("Error: Failed to write footer to archive");
-        if (fclose(archive_fpointer) != 0) {
-            printf("Error closing file.");
+    size_t padded = (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    size_t fill = remaining + (padded - size);
+    memset(engine->buffer, 0, fill < engine->chunk_size ? fill : engine->chunk_size);
+    while (fill > 0) {
+        size_t n = fill < engine->chunk_size ? fill : engine->chunk_size;
+        if (fwrite(engine->buffer, 1, n, dst) != n) {
+            perror("Error: Failed to write file contents to archive");
             return -1;
         }
-        return -1;
+        fill -= n;
     }
-}
 
-if (fclose(archive_fpointer) != 0) {
-    printf("Error closing file.");
-    return -1;
-}
-return 0;
+    // Only members the kernel actually moved data for count towards its stats
+    if (remaining == size) {
+        return 0;
+    }
+    if (used_sendfile) {
+        engine->num_sendfile++;
+    } else {
+        engine->num_copy_file_range++;
+    }
+    return 0;
 }
 
-int get_archive_file_list(const char *archive_name, file_list_t *files) {
-    // Open the archive file for reading purposes
-    FILE *archive = fopen(archive_name, "rb");
-    if (!archive) {
-        perror("Unable to open archive file");
+int dedup_member(copy_engine_t *engine, tar_header *header, const struct stat *stat_buf,
+                 uint32_t digest, int file_fd, const char *payload) {
+    size_t size = member_size(header);
+    char member_name[MEMBER_NAME_BUF_LEN];
+    get_member_name(header, member_name, sizeof(member_name));
+    const char *target;
+    if (dedup_find(&engine->dedup, member_name, stat_buf, size, digest, file_fd, payload,
+                   &target) != 0) {
         return -1;
     }
-
-    tar_header header;
-    size_t num_read;
-    int end_of_archive = 0;
-    // Continue the loop while we haven't hit the end of the archive and we continue reading in
-    // BLOCK_SIZE (512) bits
-    while (!end_of_archive && (num_read = fread(&header, 1, BLOCK_SIZE, archive)) == BLOCK_SIZE) {
-        // If the block is empty check if the next block is empty
-        if (is_empty_block((char *) &header)) {
-            // Peek at the next header block
-            long current_pos = ftell(archive);    // Save current position
-            tar_header next_header;
-            if (fread(&next_header, 1, BLOCK_SIZE, archive) != BLOCK_SIZE) {
-                // Couldn't read a full header; assume end of archive
-                break;
-            }
-
-            if (is_empty_block((char *) &next_header)) {
-                // Two consecutive empty blocks found: end of archive.
-                end_of_archive = 1;
-            } else {
-                // Not two consecutive empty blocks:
-                // Rewind back one header block so that next_header is processed in the next
-                // iteration.
-                if (fseek(archive, current_pos, SEEK_SET) != 0) {
-                    perror("Error seeking back in archive");
-                    fclose(archive);
-                    return -1;
-                }
-            }
-            continue;
-        }
-
-        // Truncate name if necessary to fit into the file list node
-        char truncated_name[MAX_NAME_LEN + 1];
-        strncpy(truncated_name, header.name, MAX_NAME_LEN);
-        truncated_name[MAX_NAME_LEN] = '\0';
-        // Add the file name to the file list
-        if (file_list_add(files, truncated_name) != 0) {
-            perror("Failed to add file to the list");
-            fclose(archive);
-            return -1;
-        }
-
-        // Calculate the number of blocks to skip for the file content
-        long file_size = strtol(header.size, NULL, 8);
-        long blocks_to_skip = (file_size + 511) / 512;
-        // Move the cursor to th enext header block
-        if (fseek(archive, blocks_to_skip * 512, SEEK_CUR) != 0) {
-            perror("Error seeking in archive");
-            fclose(archive);
+    if (target == NULL) {
+        // Only a name that fits in the linkname field can be linked to
+        if (strlen(member_name) < sizeof(header->linkname) &&
+            dedup_add(&engine->dedup, member_name, stat_buf, size, digest) != 0) {
             return -1;
         }
+        return 0;
     }
 
-    if (ferror(archive) != 0) {
-        perror("Error reading archive file");
-        fclose(archive);
-        return -1;
+    // Targets are only recorded when they fit, but a link must never be cut short
+    size_t target_len = strlen(target);
+    if (target_len > sizeof(header->linkname)) {
+        return 0;
     }
+    memset(header->linkname, 0, sizeof(header->linkname));
+    memcpy(header->linkname, target, target_len);
+    snprintf(header->size, 12, "%011o", 0);    // A link carries no data
+    header->typeflag = LNKTYPE;
+    compute_checksum(header);
+    engine->num_dedup_links++;
+    engine->dedup_bytes += size;
+    return 1;
+}
 
-    if (fclose(archive) != 0) {
-        perror("Error closing file.");
-        return -1;
+int write_member_payload(FILE *archive_fp, int file_fd, const tar_header *header,
+                         copy_engine_t *engine) {
+    // Directories and empty files have no data blocks to copy
+    if (member_size(header) == 0) {
+        return 0;
     }
-    return 0;
+    int copy_result = 1;
+    if (minitar_options.zero_copy) {
+        copy_result = copy_member_data_in_kernel(engine, file_fd, archive_fp,
+                                                 member_size(header));
+    }
+    if (copy_result == 1) {
+        copy_result = copy_member_data(engine, file_fd, archive_fp, member_size(header), NULL);
+        engine->num_buffered++;
+    }
+    return copy_result == 0 ? 0 : -1;
+}
+
+int write_member_then_dedup(FILE *archive_fp, int file_fd, tar_header *header,
+                            const struct stat *stat_buf, copy_engine_t *engine) {
+    off_t header_offset = ftello(archive_fp);
+    if (header_offset < 0 || fwrite(header, BLOCK_SIZE, 1, archive_fp) != 1) {
+        perror("Error: Failed to write header to archive");
+        return -1;
+    }
+    // Copied through the buffer so the digest is taken as the data streams
+    uint32_t digest;
+    if (copy_member_data(engine, file_fd, archive_fp, member_size(header), &digest) != 0) {
+        return -1;
+    }
+    engine->num_buffered++;
+
+    int linked = dedup_member(engine, header, stat_buf, digest, file_fd, NULL);
+    if (linked <= 0) {
+        return linked;
+    }
+    // The link's header replaces the one written, and whatever comes next
+    // overwrites the data that is no longer needed
+    if (fseeko(archive_fp, header_offset, SEEK_SET) != 0 ||
+        fwrite(header, BLOCK_SIZE, 1, archive_fp) != 1) {
+        perror("Error: Failed to rewrite member as a link");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Writes a header block followed by the padded contents of the file
+ * identified by 'file_name' to the current position of 'archive_fp', taking
+ * over 'fd' if the file is already open as that descriptor rather than -1.
+ * The header that was written is left in 'header'.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int write_member(FILE *archive_fp, const char *file_name, int fd, copy_engine_t *engine,
+                 tar_header *header) {
+    // Open the file and populate the tar header from the open descriptor
+    struct stat stat_buf;
+    int file_fd = open_member(file_name, fd, header, &stat_buf);
+    if (file_fd < 0) {
+        perror("Error: Failed to create tar header");
+        return -1;
+    }
+
+    // A repeat of an earlier member's contents is stored as a link to it
+    int linked = 0;
+    int dedup = minitar_options.dedup && S_ISREG(stat_buf.st_mode) && member_size(header) > 0;
+    if (dedup && engine->dedup_after_copy) {
+        int result = write_member_then_dedup(archive_fp, file_fd, header, &stat_buf, engine);
+        if (close(file_fd) != 0) {
+            printf("Error closing file.");
+            return -1;
+        }
+        return result;
+    }
+    if (dedup) {
+        // The link must be known before the header goes out
+        uint32_t digest;
+        if (dedup_digest_fd(file_fd, member_size(header), &digest) != 0 ||
+            (linked = dedup_member(engine, header, &stat_buf, digest, file_fd, NULL)) < 0) {
+            close(file_fd);
+            return -1;
+        }
+    }
+
+    // Write the header to the archive
+    if (fwrite(header, BLOCK_SIZE, 1, archive_fp) != 1) {
+        perror("Error: Failed to write header to archive");
+        close(file_fd);
+        return -1;
+    }
+
+    int result = linked ? 0 : write_member_payload(archive_fp, file_fd, header, engine);
+    if (close(file_fd) != 0) {
+        printf("Error closing file.");
+        return -1;
+    }
+    return result;
+}
+
+/*
+ * Determines whether members written to 'archive_fp' can be taken back and
+ * rewritten: it must be a regular file written at its current offset, not a
+ * pipe, an O_APPEND descriptor or a compression stage.
+ */
+static int is_rewritable(FILE *archive_fp) {
+    int fd = fileno(archive_fp);
+    struct stat stat_buf;
+    if (fd < 0 || fstat(fd, &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode)) {
+        return 0;
+    }
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && !(flags & O_APPEND);
+}
+
+/*
+ * Writes every file in 'files' to 'archive_fp', followed by the two
+ * all-zero blocks that mark the end of the archive, taking over the
+ * descriptors in 'held', which may be NULL. If 'index' is not NULL, each
+ * member written is recorded in it.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int write_members_and_footer(FILE *archive_fp, const file_list_t *files, held_files_t *held,
+                             archive_index_t *index) {
+    copy_engine_t engine;
+    if (copy_engine_init(&engine, minitar_options.copy_chunk_size) != 0) {
+        return -1;
+    }
+    engine.dedup_after_copy = minitar_options.dedup && is_rewritable(archive_fp);
+
+    if (minitar_options.num_threads > 1) {
+        // Headers and small payloads are prepared by worker threads
+        if (write_members_parallel(archive_fp, files, held, index, &engine,
+                                   minitar_options.num_threads) != 0) {
+            copy_engine_free(&engine);
+            return -1;
+        }
+    } else {
+        // Iterating through each file in the linked list
+        node_t *current = files->head;
+        for (size_t position = 0; current != NULL; position++) {
+            off_t header_offset = ftello(archive_fp);
+            tar_header header;
+            if (write_member(archive_fp, current->name, held_files_take(held, position), &engine,
+                             &header) != 0 ||
+                (index != NULL && archive_index_add(index, &header, header_offset) != 0)) {
+                copy_engine_free(&engine);
+                return -1;
+            }
+            current = current->next;
+        }
+    }
+    if (minitar_options.zero_copy) {
+        fprintf(stderr,
+                "Zero-copy: %lu member(s) via copy_file_range, %lu via sendfile, %lu buffered\n",
+                engine.num_copy_file_range, engine.num_sendfile, engine.num_buffered);
+    }
+    if (minitar_options.dedup) {
+        fprintf(stderr, "Dedup: %lu member(s) stored as links, %llu bytes not written\n",
+                engine.num_dedup_links, engine.dedup_bytes);
+    }
+    int dedup_after_copy = engine.dedup_after_copy;
+    copy_engine_free(&engine);
+
+    if (index != NULL) {
+        index->end_offset = ftello(archive_fp);
+    }
+
+    // 2 tar footers made of zeroes.
+    char zeros[NUM_TRAILING_BLOCKS * BLOCK_SIZE] = {0};
+    if (fwrite(zeros, sizeof(zeros), 1, archive_fp) != 1) {
+        perror("Error: Failed to write footer to archive");
+        return -1;
+    }
+    // Data taken back from members turned into links may lie past the footer
+    if (dedup_after_copy &&
+        (fflush(archive_fp) != 0 || ftruncate(fileno(archive_fp), ftello(archive_fp)) != 0)) {
+        perror("Error: Failed to truncate archive");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Determines whether writes to 'archive_name' should keep its index file up
+ * to date: either indexing was requested or the archive already has one.
+ * Compressed archives are never indexed, since member offsets within the
+ * decompressed stream cannot be seeked to.
+ */
+int should_maintain_index(const char *archive_name) {
+    if (minitar_options.compress) {
+        return 0;
+    }
+    return minitar_options.use_index || archive_index_exists(archive_name);
+}
+
+/*
+ * Refuses to modify 'archive_name' in place if it is compressed, as the
+ * footer cannot be cut off of a gzip stream.
+ * Returns 0 if the archive can be appended to or -1 otherwise
+ */
+int check_appendable(const char *archive_name) {
+    int compressed = is_compressed_archive(archive_name);
+    if (compressed == 1) {
+        fprintf(stderr, "Error: Cannot append to a compressed archive\n");
+    }
+    return compressed == 0 ? 0 : -1;
+}
+
+/*
+ * Loads the index of 'archive_name', rebuilding it from the archive's headers
+ * when the index file is missing or out of date.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int load_or_build_index(archive_index_t *index, const char *archive_name) {
+    int loaded = archive_index_load(index, archive_name);
+    if (loaded != 0) {
+        return loaded == 1 ? 0 : -1;
+    }
+
+    archive_view_t view;
+    if (archive_view_open(&view, archive_name) != 0) {
+        return -1;
+    }
+    int result = archive_index_scan(index, &view, 0);
+    archive_view_close(&view);
+    return result;
+}
+
+/*
+ * Checks the header of each of the 'count' indexed members at 'entries'
+ * against the archive identified by 'archive_name', so that answers taken
+ * from an index file still notice a damaged or mismatched archive.
+ * Returns 0 if every header matches or -1 otherwise
+ */
+static int check_indexed_headers(const char *archive_name, const index_entry_t *entries,
+                                 size_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    archive_view_t view;
+    if (archive_view_open(&view, archive_name) != 0) {
+        return -1;
+    }
+    int result = 0;
+    for (size_t i = 0; i < count && result == 0; i++) {
+        if (!archive_index_fits(&entries[i], 0, view.size)) {
+            fprintf(stderr, "Error: Archive is truncated\n");
+            result = -1;
+        } else {
+            result = archive_index_check_header(
+                &entries[i], (const tar_header *) (view.data + entries[i].offset));
+        }
+    }
+    archive_view_close(&view);
+    return result;
+}
+
+/*
+ * Builds a compression dictionary for the members in 'files' from a sample
+ * of them: the leading bytes of small members picked at even steps through
+ * the whole list, as many as fit, skipping samples identical to one already
+ * taken, followed by the header block of the first member. Deflate refers to
+ * the end of the dictionary most cheaply, and every frame starts with a
+ * header, so the header goes last. Samples are read through the descriptors
+ * in 'held', which may be NULL, without taking them over.
+ * Returns the dictionary's length, or -1 if an error occurs
+ */
+ssize_t train_dictionary(const file_list_t *files, const held_files_t *held,
+                         unsigned char *dictionary) {
+    // Small members at up to DICTIONARY_CANDIDATES even steps through the list
+    const node_t *candidates[DICTIONARY_CANDIDATES];
+    size_t candidate_positions[DICTIONARY_CANDIDATES];
+    size_t num_candidates = 0;
+    size_t total = 0;
+    size_t num_members = files->size;
+    size_t num_steps = num_members < DICTIONARY_CANDIDATES ? num_members : DICTIONARY_CANDIDATES;
+    size_t position = 0;
+    for (const node_t *current = files->head; current != NULL && num_candidates < num_steps;
+         current = current->next, position++) {
+        // Candidate i is the first small member at or after position i * size / steps
+        if (position < num_candidates * num_members / num_steps) {
+            continue;
+        }
+        struct stat stat_buf;
+        int fd = held_files_peek(held, position);
+        int result = fd >= 0 ? fstat(fd, &stat_buf) : stat(current->name, &stat_buf);
+        // Larger members have enough data of their own to compress well
+        if (result != 0 || !S_ISREG(stat_buf.st_mode) || stat_buf.st_size > SMALL_MEMBER_MAX) {
+            continue;
+        }
+        candidate_positions[num_candidates] = position;
+        candidates[num_candidates++] = current;
+        total += stat_buf.st_size < DICTIONARY_SAMPLE_MAX ? stat_buf.st_size : DICTIONARY_SAMPLE_MAX;
+    }
+
+    // Thin the candidates out evenly until their samples fit
+    size_t room = MAX_DICTIONARY_SIZE - BLOCK_SIZE;
+    size_t num_picks = num_candidates;
+    if (total > room) {
+        num_picks = num_candidates * room / total;
+        if (num_picks == 0) {
+            num_picks = 1;
+        }
+    }
+
+    // Where each distinct sample taken so far sits in the dictionary
+    size_t sample_offsets[DICTIONARY_CANDIDATES];
+    size_t sample_lens[DICTIONARY_CANDIDATES];
+    size_t num_samples = 0;
+    size_t len = 0;
+    for (size_t i = 0; i < num_picks && len < room; i++) {
+        size_t pick = i * num_candidates / num_picks;
+        const node_t *current = candidates[pick];
+        int held_fd = held_files_peek(held, candidate_positions[pick]);
+        int fd = held_fd >= 0 ? held_fd : open(current->name, O_RDONLY);
+        if (fd < 0) {
+            perror("Error: Failed to open member file");
+            return -1;
+        }
+        // pread leaves the offset of a descriptor held for the archive alone
+        size_t want = room - len < DICTIONARY_SAMPLE_MAX ? room - len : DICTIONARY_SAMPLE_MAX;
+        ssize_t n = pread(fd, dictionary + len, want, 0);
+        if (fd != held_fd) {
+            close(fd);
+        }
+        if (n < 0) {
+            perror("Error: Failed to read member file");
+            return -1;
+        }
+
+        // A repeated sample adds nothing the dictionary does not already hold
+        int duplicate = 0;
+        for (size_t j = 0; j < num_samples && !duplicate; j++) {
+            duplicate = sample_lens[j] == (size_t) n &&
+                        memcmp(dictionary + sample_offsets[j], dictionary + len, n) == 0;
+        }
+        if (!duplicate && n > 0) {
+            sample_offsets[num_samples] = len;
+            sample_lens[num_samples] = n;
+            num_samples++;
+            len += n;
+        }
+    }
+
+    if (files->head != NULL) {
+        // Built the way open_member builds it, from the open descriptor
+        int held_fd = held_files_peek(held, 0);
+        int fd = held_fd >= 0 ? held_fd : open(files->head->name, O_RDONLY | O_CLOEXEC);
+        struct stat stat_buf;
+        tar_header header;
+        int result = fd >= 0 && fstat(fd, &stat_buf) == 0 ? 0 : -1;
+        if (result == 0) {
+            result = fill_tar_header_from_stat(&header, files->head->name, &stat_buf);
+        }
+        if (fd >= 0 && fd != held_fd) {
+            close(fd);
+        }
+        if (result != 0) {
+            perror("Error: Failed to create tar header");
+            return -1;
+        }
+        memcpy(dictionary + len, &header, BLOCK_SIZE);
+        len += BLOCK_SIZE;
+    }
+    return len;
+}
+
+/*
+ * Writes a deletion manifest member holding the 'len' bytes of NUL-terminated
+ * paths in 'deletions' at the current position of 'archive_fp', recording it
+ * in 'index' unless that is NULL.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int write_deletion_manifest(FILE *archive_fp, const char *deletions, size_t len,
+                                   archive_index_t *index) {
+    tar_header header;
+    memset(&header, 0, BLOCK_SIZE);
+    if (set_member_name(&header, DELETIONS_NAME) != 0) {
+        return -1;
+    }
+    snprintf(header.mode, 8, "%07o", 0644);
+    snprintf(header.uid, 8, "%07o", getuid());
+    snprintf(header.gid, 8, "%07o", getgid());
+    if (set_member_size(&header, len) != 0) {
+        return -1;
+    }
+    snprintf(header.mtime, 12, "%011o", (unsigned) time(NULL));
+    header.typeflag = DELETIONTYPE;
+    strncpy(header.magic, MAGIC, 6);
+    memcpy(header.version, "00", 2);
+    compute_checksum(&header);
+
+    off_t header_offset = ftello(archive_fp);
+    char padding[BLOCK_SIZE] = {0};
+    size_t padding_len = (BLOCK_SIZE - len % BLOCK_SIZE) % BLOCK_SIZE;
+    if (fwrite(&header, BLOCK_SIZE, 1, archive_fp) != 1 ||
+        fwrite(deletions, 1, len, archive_fp) != len ||
+        fwrite(padding, 1, padding_len, archive_fp) != padding_len) {
+        perror("Error: Failed to write deletion manifest to archive");
+        return -1;
+    }
+    if (index != NULL && archive_index_add(index, &header, header_offset) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Creates the archive identified by 'archive_name' from exactly the files in
+ * 'files', with any directories already expanded, taking over the
+ * descriptors in 'held'. Unless 'deletions' is NULL, a deletion manifest
+ * holding its 'deletions_len' bytes is stored first.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int create_archive_from_list(const char *archive_name, const file_list_t *files,
+                                    held_files_t *held, const char *deletions,
+                                    size_t deletions_len) {
+    archive_index_t index;
+    archive_index_init(&index);
+    archive_index_t *index_ptr = should_maintain_index(archive_name) ? &index : NULL;
+
+    if (minitar_options.preallocate) {
+        int result = create_archive_preallocated(archive_name, files, held, index_ptr,
+                                                 minitar_options.num_threads);
+        if (result == 0 && index_ptr != NULL) {
+            result = archive_index_save(index_ptr, archive_name);
+        }
+        archive_index_free(&index);
+        return result;
+    }
+
+    // Open the archive file for writing (overwrite if it exists); with -z the
+    // tar stream passes through a gzip stage on its way to the file, which
+    // is spread over the worker threads as well when there are several.
+    // A seekable archive carries its member index inside the archive instead
+    // of in an index file.
+    archive_index_t *members = minitar_options.seekable ? &index : index_ptr;
+    FILE *archive_fp;
+    if (minitar_options.dictionary) {
+        // The dictionary stream follows the headers and indexes members itself
+        members = NULL;
+        unsigned char dictionary[MAX_DICTIONARY_SIZE];
+        ssize_t dictionary_len = train_dictionary(files, held, dictionary);
+        if (dictionary_len < 0) {
+            archive_index_free(&index);
+            return -1;
+        }
+        archive_fp = dictionary_stream_open(archive_name, dictionary, dictionary_len);
+    } else if (minitar_options.seekable) {
+        archive_fp = parallel_compressed_stream_open(archive_name, minitar_options.num_threads,
+                                                     &index);
+    } else if (minitar_options.compress && minitar_options.num_threads > 1) {
+        archive_fp = parallel_compressed_stream_open(archive_name, minitar_options.num_threads,
+                                                     NULL);
+    } else if (minitar_options.compress) {
+        archive_fp = compressed_stream_open(archive_name, "wb");
+    } else {
+        archive_fp = fopen(archive_name, "wb");
+    }
+    if (!archive_fp) {
+        perror("Error: Failed to open archive file for writing");
+        return -1;
+    }
+
+    if ((deletions != NULL &&
+         write_deletion_manifest(archive_fp, deletions, deletions_len, members) != 0) ||
+        write_members_and_footer(archive_fp, files, held, members) != 0) {
+        if (fclose(archive_fp) != 0) {    // checking if file actually closed
+            printf("Error closing file.");
+        }
+        archive_index_free(&index);
+        return -1;
+    }
+
+    if (fclose(archive_fp) != 0) {
+        printf("Error closing file.");
+        archive_index_free(&index);
+        return -1;
+    }
+
+    int result = 0;
+    if (index_ptr != NULL) {
+        result = archive_index_save(index_ptr, archive_name);
+    }
+    archive_index_free(&index);
+    return result;
+}
+
+// Orders paths so that a directory's contents come before the directory itself
+static int compare_paths_descending(const void *a, const void *b) {
+    return strcmp(*(const char *const *) b, *(const char *const *) a);
+}
+
+/*
+ * Builds the deletion manifest for an incremental create: every path in
+ * 'previous' that is missing from 'current' or has changed between file and
+ * directory, as NUL-terminated strings in '*deletions' (NULL if there are
+ * none), which the caller must free.
+ * Returns the number of paths listed, or -1 if an error occurs
+ */
+static ssize_t build_deletion_manifest(const snapshot_t *previous, const snapshot_t *current,
+                                       char **deletions, size_t *len) {
+    *deletions = NULL;
+    *len = 0;
+    if (previous->count == 0) {
+        return 0;
+    }
+    const char **deleted = malloc(previous->count * sizeof(char *));
+    if (deleted == NULL) {
+        perror("Failed to build deletion manifest");
+        return -1;
+    }
+    size_t num_deleted = 0;
+    size_t total_len = 0;
+    for (size_t i = 0; i < previous->count; i++) {
+        const snapshot_entry_t *entry = &previous->entries[i];
+        const snapshot_entry_t *now = snapshot_find(current, entry->path);
+        if (now == NULL || now->is_dir != entry->is_dir) {
+            deleted[num_deleted++] = entry->path;
+            total_len += strlen(entry->path) + 1;
+        }
+    }
+    if (num_deleted > 1) {
+        qsort(deleted, num_deleted, sizeof(char *), compare_paths_descending);
+    }
+
+    if (num_deleted > 0) {
+        *deletions = malloc(total_len);
+        if (*deletions == NULL) {
+            perror("Failed to build deletion manifest");
+            free(deleted);
+            return -1;
+        }
+        for (size_t i = 0; i < num_deleted; i++) {
+            size_t path_len = strlen(deleted[i]) + 1;
+            memcpy(*deletions + *len, deleted[i], path_len);
+            *len += path_len;
+        }
+    }
+    free(deleted);
+    return num_deleted;
+}
+
+/*
+ * Creates the incremental archive 'archive_name' from 'files', with any
+ * directories already expanded and the descriptors the walk left open in
+ * 'held', against the snapshot file 'snapshot_name'.
+ * Files whose device, inode, size, mtime and ctime all match the snapshot
+ * are left out; directories are always stored so that extracting the
+ * increment recreates the tree around the files that changed. Once the
+ * archive is complete the snapshot is replaced by the state just archived.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int create_incremental_archive(const char *archive_name, const file_list_t *files,
+                                      held_files_t *held, const char *snapshot_name) {
+    snapshot_t previous;
+    snapshot_t current;
+    snapshot_init(&previous);
+    snapshot_init(&current);
+    file_list_t changed;
+    file_list_init(&changed);
+    held_files_t changed_held;
+    held_files_init(&changed_held);
+
+    int result = snapshot_load(&previous, snapshot_name);
+    size_t position = 0;
+    for (node_t *node = files->head; node != NULL && result == 0;
+         node = node->next, position++) {
+        // Recorded before the file is read, so a change made while it is
+        // being archived shows up as a change on the next run
+        struct stat stat_buf;
+        int fd = held_files_peek(held, position);
+        if ((fd >= 0 ? fstat(fd, &stat_buf) : stat(node->name, &stat_buf)) != 0) {
+            char err_msg[MAX_MSG_LEN];
+            snprintf(err_msg, MAX_MSG_LEN, "Failed to stat file %s", node->name);
+            perror(err_msg);
+            result = -1;
+            break;
+        }
+        const snapshot_entry_t *entry = snapshot_find(&previous, node->name);
+        if (snapshot_add(&current, node->name, &stat_buf) != 0) {
+            result = -1;
+        } else if (entry == NULL || S_ISDIR(stat_buf.st_mode) ||
+                   snapshot_entry_changed(entry, &stat_buf)) {
+            if (file_list_add(&changed, node->name) != 0) {
+                perror("Failed to add file to the list");
+                result = -1;
+            } else if (held_files_add(&changed_held, fd) != 0) {
+                perror("Failed to allocate descriptor table");
+                result = -1;
+            } else {
+                // The file is archived through the descriptor the walk opened
+                held_files_take(held, position);
+            }
+        }
+    }
+
+    char *deletions = NULL;
+    size_t deletions_len = 0;
+    ssize_t num_deleted = 0;
+    if (result == 0) {
+        num_deleted = build_deletion_manifest(&previous, &current, &deletions, &deletions_len);
+        if (num_deleted < 0) {
+            result = -1;
+        }
+    }
+    if (result == 0) {
+        result = create_archive_from_list(archive_name, &changed, &changed_held, deletions,
+                                          deletions_len);
+    }
+    if (result == 0) {
+        result = snapshot_save(&current, snapshot_name);
+    }
+    if (result == 0) {
+        fprintf(stderr, "Incremental: %d of %zu path(s) archived, %zd deleted\n",
+                changed.size, current.count, num_deleted);
+    }
+
+    free(deletions);
+    held_files_close(&changed_held);
+    file_list_clear(&changed);
+    snapshot_free(&current);
+    snapshot_free(&previous);
+    return result;
+}
+
+int create_archive(const char *archive_name, const file_list_t *files) {
+    // Directories are archived along with everything beneath them
+    file_list_t expanded;
+    file_list_init(&expanded);
+    held_files_t held;
+    held_files_init(&held);
+    int result = expand_directories(files, &expanded, &held, minitar_options.num_threads);
+    if (result == 0 && minitar_options.snapshot_file != NULL) {
+        result = create_incremental_archive(archive_name, &expanded, &held,
+                                            minitar_options.snapshot_file);
+    } else if (result == 0) {
+        result = create_archive_from_list(archive_name, &expanded, &held, NULL, 0);
+    }
+    held_files_close(&held);
+    file_list_clear(&expanded);
+    return result;
+}
+
+/*
+ * Appends 'files' to the archive identified by 'archive_name', taking over
+ * the descriptors in 'held', which may be NULL. 'index' is
+ * either NULL, when no index file is kept for the archive, or the archive's
+ * index as loaded before the append; it is extended and saved afterwards.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int append_members(const char *archive_name, const file_list_t *files, held_files_t *held,
+                   archive_index_t *index) {
+    if (remove_trailing_bytes(archive_name, NUM_TRAILING_BLOCKS * BLOCK_SIZE) != 0) {
+        perror("Could not remove the 2 archive footers.");
+        return -1;
+    }
+
+    // Opened without O_APPEND, which copy_file_range and sendfile reject
+    FILE *archive_fpointer = fopen(archive_name, "r+b");
+    if (!archive_fpointer) {
+        perror("Error with archive file opening.");
+        return -1;
+    }
+
+    if (fseek(archive_fpointer, 0, SEEK_END) != 0) {
+        perror("Error seeking to end of current archive file.");
+        if (fclose(archive_fpointer) != 0) {
+            printf("Error closing file.");
+        }
+        return -1;
+    }
+
+    if (write_members_and_footer(archive_fpointer, files, held, index) != 0) {
+        if (fclose(archive_fpointer) != 0) {
+            printf("Error closing file.");
+        }
+        return -1;
+    }
+
+    if (fclose(archive_fpointer) != 0) {
+        printf("Error closing file.");
+        return -1;
+    }
+
+    if (index != NULL) {
+        return archive_index_save(index, archive_name);
+    }
+    return 0;
+}
+
+int append_files_to_archive(const char *archive_name, const file_list_t *files) {
+    if (check_appendable(archive_name) != 0) {
+        return -1;
+    }
+
+    archive_index_t index;
+    archive_index_init(&index);
+    archive_index_t *index_ptr = NULL;
+    if (should_maintain_index(archive_name)) {
+        // Must happen before the archive is touched, while the index can still be validated
+        if (load_or_build_index(&index, archive_name) != 0) {
+            archive_index_free(&index);
+            return -1;
+        }
+        index_ptr = &index;
+    }
+
+    file_list_t expanded;
+    file_list_init(&expanded);
+    held_files_t held;
+    held_files_init(&held);
+    int result = expand_directories(files, &expanded, &held, minitar_options.num_threads);
+    if (result == 0) {
+        result = append_members(archive_name, &expanded, &held, index_ptr);
+    }
+    held_files_close(&held);
+    file_list_clear(&expanded);
+    archive_index_free(&index);
+    return result;
+}
+
+/*
+ * Converts a 0-padded octal header field of at most 'len' bytes to a number.
+ * Parsing stops at the first character that is not an octal digit, so the
+ * field does not need to be null-terminated.
+ */
+unsigned long long parse_octal(const char *field, size_t len) {
+    unsigned long long value = 0;
+    size_t i = 0;
+    while (i < len && field[i] == ' ') {
+        i++;
+    }
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = (value << 3) | (unsigned) (field[i] - '0');
+    }
+    return value;
+}
+
+// Returns the size in bytes of the member described by 'header'
+size_t member_size(const tar_header *header) {
+    return parse_octal(header->size, sizeof(header->size));
+}
+
+int set_member_size(tar_header *header, unsigned long long size) {
+    if (size > MAX_MEMBER_SIZE) {
+        char member_name[MEMBER_NAME_BUF_LEN];
+        get_member_name(header, member_name, sizeof(member_name));
+        fprintf(stderr, "Error: '%s' is too large for a tar member (%llu bytes, limit %llu)\n",
+                member_name, size, MAX_MEMBER_SIZE);
+        errno = EFBIG;
+        return -1;
+    }
+    snprintf(header->size, 12, "%011llo", size);
+    return 0;
+}
+
+/*
+ * Writes the full path of the member described by 'header' into 'buf',
+ * joining the prefix and name fields. Neither field has to be
+ * null-terminated when it is completely filled.
+ */
+void get_member_name(const tar_header *header, char *buf, size_t buf_len) {
+    if (header->prefix[0] != '\0') {
+        snprintf(buf, buf_len, "%.*s/%.*s", (int) sizeof(header->prefix), header->prefix,
+                 (int) sizeof(header->name), header->name);
+    } else {
+        snprintf(buf, buf_len, "%.*s", (int) sizeof(header->name), header->name);
+    }
+}
+
+int archive_view_open(archive_view_t *view, const char *archive_name) {
+    view->data = NULL;
+    view->size = 0;
+
+    int fd = open(archive_name, O_RDONLY);
+    if (fd < 0) {
+        perror("Unable to open archive file");
+        return -1;
+    }
+
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) != 0) {
+        perror("Failed to stat archive file");
+        close(fd);
+        return -1;
+    }
+
+    // An empty file cannot be mapped, but it is still a (member-less) archive
+    if (stat_buf.st_size > 0) {
+        void *data = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror("Failed to map archive file");
+            close(fd);
+            return -1;
+        }
+        // Archives are walked front to back, so ask for aggressive readahead
+        madvise(data, stat_buf.st_size, MADV_SEQUENTIAL);
+        view->data = data;
+        view->size = stat_buf.st_size;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    if (close(fd) != 0) {
+        perror("Error closing file.");
+        archive_view_close(view);
+        return -1;
+    }
+    return 0;
+}
+
+void archive_view_close(archive_view_t *view) {
+    if (view->data != NULL) {
+        munmap((void *) view->data, view->size);
+    }
+    view->data = NULL;
+    view->size = 0;
+}
+
+int archive_view_next(const archive_view_t *view, size_t *offset, const tar_header **header) {
+    while (*offset + BLOCK_SIZE <= view->size) {
+        const char *block = view->data + *offset;
+        // If the block is empty check if the next block is empty
+        size_t remaining = (view->size - *offset) / BLOCK_SIZE;
+        size_t empty = zero_block_run(block, remaining < 2 ? remaining : 2);
+        if (empty > 0) {
+            if (empty == 2 || remaining == 1) {
+                // Two consecutive empty blocks (or a lone one at EOF): end of archive
+                return 0;
+            }
+            // A single stray empty block; the next block is a header
+            *offset += BLOCK_SIZE;
+            continue;
+        }
+
+        const tar_header *found = (const tar_header *) block;
+        if (!verify_checksum(found)) {
+            fprintf(stderr, "Error: Header checksum mismatch at offset %zu\n", *offset);
+            return -1;
+        }
+        size_t data_blocks = (member_size(found) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (data_blocks > (view->size - *offset) / BLOCK_SIZE - 1) {
+            fprintf(stderr, "Error: Archive is truncated\n");
+            return -1;
+        }
+        *header = found;
+        *offset += (1 + data_blocks) * BLOCK_SIZE;
+        return 1;
+    }
+    return 0;
+}
+
+int member_is_directory(const char *name) {
+    size_t len = strlen(name);
+    return len > 0 && name[len - 1] == '/';
+}
+
+int is_contained_path(const char *path) {
+    if (path[0] == '/') {
+        return 0;
+    }
+    for (const char *component = path;; component++) {
+        if (strncmp(component, "..", 2) == 0 && (component[2] == '/' || component[2] == '\0')) {
+            return 0;
+        }
+        component = strchr(component, '/');
+        if (component == NULL) {
+            return 1;
+        }
+    }
+}
+
+int check_extract_path(const char *name) {
+    if (!is_contained_path(name)) {
+        fprintf(stderr, "Error: Refusing to extract '%s', which is outside the archive\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Checks the name of every final member in 'index' with check_extract_path,
+ * so that an archive holding a member that would escape the extraction
+ * directory is refused before anything is written.
+ * Returns 0 if every name can be extracted or -1 if not
+ */
+static int check_index_paths(const archive_index_t *index) {
+    for (size_t i = 0; i < index->count; i++) {
+        const index_entry_t *entry = &index->entries[i];
+        if (archive_index_is_final(index, entry) && check_extract_path(entry->name) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int has_symlinked_parent(const char *path) {
+    char parent[MEMBER_NAME_BUF_LEN];
+    snprintf(parent, sizeof(parent), "%s", path);
+    for (char *slash = strchr(parent + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        struct stat stat_buf;
+        if (lstat(parent, &stat_buf) == 0 && S_ISLNK(stat_buf.st_mode)) {
+            return 1;
+        }
+        *slash = '/';
+    }
+    return 0;
+}
+
+int make_member_directories(const char *name) {
+    char path[MEMBER_NAME_BUF_LEN];
+    snprintf(path, sizeof(path), "%s", name);
+    for (char *slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Failed to create directory %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        *slash = '/';
+    }
+    return 0;
+}
+
+/*
+ * Opens a new file for the extracted member 'file_name' for writing. Missing
+ * parent directories are only created when opening fails for want of them,
+ * so archives without directory entries cost nothing extra.
+ * Returns the stream or NULL if an error occurs
+ */
+FILE *create_extracted_file(const char *file_name) {
+    // A name hard-linked to another, by a link member or an earlier
+    // extraction, is replaced rather than written through, which would change
+    // the other name as well. A failure here is left for fopen to report
+    unlink(file_name);
+    FILE *out = fopen(file_name, "wb");
+    if (out == NULL && errno == ENOENT && make_member_directories(file_name) == 0) {
+        out = fopen(file_name, "wb");
+    }
+    return out;
+}
+
+/*
+ * Writes 'size' bytes of member data from 'data' to a new file 'file_name'
+ * Returns 0 on success or -1 if an error occurs
+ */
+int write_extracted_file(const char *file_name, const char *data, size_t size) {
+    if (member_is_directory(file_name)) {
+        return make_member_directories(file_name);
+    }
+    FILE *out = create_extracted_file(file_name);
+    if (!out) {
+        perror("Error creating output file");
+        return -1;
+    }
+    if (fwrite(data, 1, size, out) != size) {
+        perror("Error writing to output file");
+        fclose(out);
+        return -1;
+    }
+    if (fclose(out) != 0) {
+        perror("Error closing output file");
+        return -1;
+    }
+    return 0;
+}
+
+int extract_link_member(const tar_header *header, const char *name) {
+    char target[sizeof(header->linkname) + 1];
+    memcpy(target, header->linkname, sizeof(header->linkname));
+    target[sizeof(header->linkname)] = '\0';
+
+    // A link to its own name refers to the version already extracted there
+    if (strcmp(target, name) == 0) {
+        return 0;
+    }
+    // Linking or copying a path from outside the archive would bring any
+    // file the user can read into the extracted tree
+    if (!is_contained_path(target)) {
+        fprintf(stderr, "Error: Refusing to link '%s' to '%s', which is outside the archive\n",
+                name, target);
+        return -1;
+    }
+
+    // Replace whatever an earlier extraction left under this name
+    if (unlink(name) != 0 && errno != ENOENT) {
+        fprintf(stderr, "Error: Failed to replace '%s': %s\n", name, strerror(errno));
+        return -1;
+    }
+    int linked = link(target, name) == 0;
+    if (!linked && errno == ENOENT && make_member_directories(name) == 0) {
+        linked = link(target, name) == 0;
+    }
+    if (linked) {
+        return 0;
+    }
+    if (errno != EXDEV && errno != EPERM && errno != EMLINK) {
+        fprintf(stderr, "Error: Failed to link '%s' to '%s': %s\n", name, target,
+                strerror(errno));
+        return -1;
+    }
+
+    // The file system cannot hold another link to the target, so copy it
+    FILE *in = fopen(target, "rb");
+    if (in == NULL) {
+        perror("Error opening link target");
+        return -1;
+    }
+    FILE *out = create_extracted_file(name);
+    if (out == NULL) {
+        perror("Error creating output file");
+        fclose(in);
+        return -1;
+    }
+    char buf[COMPARE_BUF_LEN];
+    size_t n;
+    int result = 0;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) {
+            perror("Error writing to output file");
+            result = -1;
+            break;
+        }
+    }
+    if (ferror(in)) {
+        perror("Error reading link target");
+        result = -1;
+    }
+    fclose(in);
+    if (fclose(out) != 0) {
+        perror("Error closing output file");
+        result = -1;
+    }
+    return result;
+}
+
+/*
+ * Finds the version of the target of the link member 'entry' of 'index',
+ * whose header is 'header', that the archive held where the link was
+ * written. A link refers to its target as it was then, whatever later
+ * versions of the target follow it.
+ * Returns that version's entry, or NULL if no earlier member has the name
+ */
+static const index_entry_t *link_target_version(const archive_index_t *index,
+                                                const index_entry_t *entry,
+                                                const tar_header *header) {
+    char target[sizeof(header->linkname) + 1];
+    memcpy(target, header->linkname, sizeof(header->linkname));
+    target[sizeof(header->linkname)] = '\0';
+    return archive_index_find_before(index, target, entry);
+}
+
+/*
+ * Finds the version of the target of the link member 'entry' of 'index',
+ * whose header is 'header', when a later version supersedes it. Linking to
+ * the extracted target would then give the link the later data.
+ * Returns the superseded version's entry, or NULL if the link can be made to
+ * the extracted target
+ */
+static const index_entry_t *superseded_link_target(const archive_index_t *index,
+                                                   const index_entry_t *entry,
+                                                   const tar_header *header) {
+    const index_entry_t *version = link_target_version(index, entry, header);
+    if (version == NULL || archive_index_is_final(index, version)) {
+        return NULL;
+    }
+    return version;
+}
+
+/*
+ * Checks that the link member 'entry' of 'index', whose header is 'header',
+ * refers to an earlier member, so that extracting it can only ever reach
+ * a file that came from the archive.
+ * Returns 0 if it does or -1 if it does not
+ */
+static int check_link_target(const archive_index_t *index, const index_entry_t *entry,
+                             const tar_header *header) {
+    if (link_target_version(index, entry, header) == NULL) {
+        fprintf(stderr, "Error: Link target of '%s' is not an earlier member\n", entry->name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Finds the version of the target of the link member 'entry' of 'index',
+ * whose header is 'header', when the link cannot be made to the extracted
+ * target: a later version supersedes it, or it is not on disk because only
+ * some members are being extracted.
+ * Returns that version's entry, whose data the link is given as a regular
+ * file, or NULL if the link can be made to the target on disk
+ */
+static const index_entry_t *unlinkable_link_target(const archive_index_t *index,
+                                                   const index_entry_t *entry,
+                                                   const tar_header *header) {
+    const index_entry_t *version = link_target_version(index, entry, header);
+    struct stat stat_buf;
+    if (version == NULL ||
+        (archive_index_is_final(index, version) && lstat(version->name, &stat_buf) == 0)) {
+        return NULL;
+    }
+    return version;
+}
+
+/*
+ * Extracts the link member 'entry' of 'index', whose header is 'header', from
+ * the uncompressed archive mapped by 'view'. A link whose target has since
+ * been superseded, or is not on disk, becomes a regular file holding the
+ * version it refers to.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int extract_mapped_link(const archive_view_t *view, const archive_index_t *index,
+                               const index_entry_t *entry, const tar_header *header) {
+    if (check_link_target(index, entry, header) != 0) {
+        return -1;
+    }
+    const index_entry_t *version = unlinkable_link_target(index, entry, header);
+    if (version == NULL) {
+        return extract_link_member(header, entry->name);
+    }
+    if (!archive_index_fits(version, version->size, view->size)) {
+        fprintf(stderr, "Error: Archive is truncated\n");
+        return -1;
+    }
+    const tar_header *target_header = (const tar_header *) (view->data + version->offset);
+    if (archive_index_check_header(version, target_header) != 0) {
+        return -1;
+    }
+    if (target_header->typeflag == LNKTYPE) {
+        // Links are only ever made to members stored in full
+        fprintf(stderr, "Error: Link target '%s' of '%s' is itself a link\n", version->name,
+                entry->name);
+        return -1;
+    }
+    return write_extracted_file(entry->name, view->data + version->offset + BLOCK_SIZE,
+                                version->size);
+}
+
+/*
+ * Creates the hard link members among the final versions in 'index' of the
+ * uncompressed archive 'archive_name'. Links are made once everything else
+ * is extracted, so that their targets exist whatever order they were
+ * written in.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int extract_link_members(const char *archive_name, const archive_index_t *index) {
+    archive_view_t view;
+    int mapped = 0;
+    int result = 0;
+    for (size_t i = 0; i < index->count && result == 0; i++) {
+        const index_entry_t *entry = &index->entries[i];
+        // Links carry no data, which rules out every other member cheaply
+        if (entry->size != 0 || !archive_index_is_final(index, entry)) {
+            continue;
+        }
+        if (!mapped && archive_view_open(&view, archive_name) != 0) {
+            return -1;
+        }
+        mapped = 1;
+        const tar_header *header = (const tar_header *) (view.data + entry->offset);
+        if (!archive_index_fits(entry, 0, view.size)) {
+            fprintf(stderr, "Error: Archive is truncated\n");
+            result = -1;
+        } else if (archive_index_check_header(entry, header) != 0) {
+            result = -1;
+        } else if (header->typeflag == LNKTYPE) {
+            result = extract_mapped_link(&view, index, entry, header);
+        }
+    }
+    if (mapped) {
+        archive_view_close(&view);
+    }
+    return result;
+}
+
+/*
+ * Removes each path listed in a deletion manifest of 'size' bytes at 'data',
+ * whose NUL-terminated paths list a directory's contents before it. Paths
+ * that are already gone are ignored, and a directory still holding files
+ * that did not come from the archive is kept with a warning, as is a path
+ * reached through a symbolic link. A path that could leave the extraction
+ * directory is refused.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int apply_deletions(const char *data, size_t size) {
+    size_t pos = 0;
+    while (pos < size) {
+        const char *path = data + pos;
+        size_t len = strnlen(path, size - pos);
+        if (len == size - pos) {
+            fprintf(stderr, "Error: Deletion manifest is corrupt\n");
+            return -1;
+        }
+        pos += len + 1;
+        if (!is_contained_path(path)) {
+            fprintf(stderr, "Error: Refusing to delete '%s', which is outside the archive\n",
+                    path);
+            return -1;
+        }
+        if (has_symlinked_parent(path)) {
+            fprintf(stderr, "Warning: Keeping deleted path '%s' behind a symbolic link\n", path);
+            continue;
+        }
+        if (remove(path) == 0 || errno == ENOENT || errno == ENOTDIR) {
+            continue;
+        }
+        if (errno == ENOTEMPTY || errno == EEXIST) {
+            fprintf(stderr, "Warning: Keeping deleted directory '%s', which is not empty\n",
+                    path);
+        } else {
+            fprintf(stderr, "Error: Failed to delete '%s': %s\n", path, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Applies the deletion manifest of the uncompressed archive 'archive_name',
+ * as located by 'index', if it has one.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int apply_deletion_manifest(const char *archive_name, const archive_index_t *index) {
+    const index_entry_t *entry = archive_index_find(index, DELETIONS_NAME);
+    if (entry == NULL) {
+        return 0;
+    }
+    archive_view_t view;
+    if (archive_view_open(&view, archive_name) != 0) {
+        return -1;
+    }
+    int result = 0;
+    const tar_header *header = (const tar_header *) (view.data + entry->offset);
+    if (!archive_index_fits(entry, entry->size, view.size)) {
+        fprintf(stderr, "Error: Archive is truncated\n");
+        result = -1;
+    } else if (archive_index_check_header(entry, header) != 0) {
+        result = -1;
+    } else if (header->typeflag == DELETIONTYPE) {
+        result = apply_deletions(view.data + entry->offset + BLOCK_SIZE, entry->size);
+    }
+    archive_view_close(&view);
+    return result;
+}
+
+/*
+ * Reads one block of the tar stream 'archive_fp' into 'block'.
+ * Returns 1 if a block was read, 0 at the end of the stream, or -1 if an error occurs
+ */
+int read_stream_block(FILE *archive_fp, char *block) {
+    size_t n = fread(block, 1, BLOCK_SIZE, archive_fp);
+    if (n == 0 && !ferror(archive_fp)) {
+        return 0;
+    }
+    if (n != BLOCK_SIZE) {
+        fprintf(stderr, "Error: Archive is truncated\n");
+        return -1;
+    }
+    return 1;
+}
+
+/*
+ * Reads the next member header of the tar stream 'archive_fp' into 'header',
+ * treating empty blocks the same way archive_view_next does.
+ * Returns 1 if a header was read, 0 at the end of the archive, or -1 if an error occurs
+ */
+int read_stream_header(FILE *archive_fp, tar_header *header) {
+    char *block = (char *) header;
+    int status = read_stream_block(archive_fp, block);
+    if (status == 1 && is_empty_block(block)) {
+        // A lone empty block is skipped; two in a row end the archive
+        status = read_stream_block(archive_fp, block);
+        if (status == 1 && is_empty_block(block)) {
+            status = 0;
+        }
+    }
+    if (status == 1 && !verify_checksum(header)) {
+        fprintf(stderr, "Error: Header checksum mismatch\n");
+        status = -1;
+    }
+    return status;
+}
+
+/*
+ * Consumes the data blocks of a member of 'size' bytes from the tar stream
+ * 'archive_fp', writing the member's contents to 'out_fp' unless it is NULL.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int read_stream_member_data(FILE *archive_fp, size_t size, FILE *out_fp,
+                            copy_engine_t *engine) {
+    size_t padded = (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    size_t done = 0;
+    while (done < padded) {
+        size_t want = padded - done < engine->chunk_size ? padded - done : engine->chunk_size;
+        if (fread(engine->buffer, 1, want, archive_fp) != want) {
+            fprintf(stderr, "Error: Archive is truncated\n");
+            return -1;
+        }
+        // The final block's padding is not part of the file
+        if (out_fp != NULL && done < size) {
+            size_t len = size - done < want ? size - done : want;
+            if (fwrite(engine->buffer, 1, len, out_fp) != len) {
+                perror("Error writing to output file");
+                return -1;
+            }
+        }
+        done += want;
+    }
+    return 0;
+}
+
+/*
+ * Opens the compressed archive 'archive_name' for reading as one tar stream.
+ * Returns the stream, or NULL if an error occurs
+ */
+static FILE *open_compressed_archive(const char *archive_name) {
+    // Frames compressed against a dictionary are only readable through the
+    // frame table; any other .tar.gz is read as one gzip stream
+    archive_index_t index;
+    archive_index_init(&index);
+    frame_table_t frames;
+    int loaded = seekable_index_load(archive_name, &index, &frames);
+    archive_index_free(&index);
+    FILE *archive_fp = NULL;
+    if (loaded == 1 && frames.dictionary != NULL) {
+        archive_fp = compressed_stream_open_at(archive_name, &frames, 0);
+    } else if (loaded != -1) {
+        archive_fp = compressed_stream_open(archive_name, "rb");
+    }
+    frame_table_free(&frames);
+    return archive_fp;
+}
+
+/*
+ * Writes the data of the member at position 'position' in the compressed
+ * archive 'archive_name', the version of a link's target that the link
+ * refers to, to a new file for the link 'name'. The stream is read again
+ * from the start, since it cannot be rewound.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int extract_stream_link_data(const char *archive_name, size_t position,
+                                    const char *name, copy_engine_t *engine) {
+    FILE *archive_fp = open_compressed_archive(archive_name);
+    if (archive_fp == NULL) {
+        return -1;
+    }
+    tar_header header;
+    int status;
+    size_t i = 0;
+    while ((status = read_stream_header(archive_fp, &header)) == 1 && i < position) {
+        if (read_stream_member_data(archive_fp, member_size(&header), NULL, engine) != 0) {
+            status = -1;
+            break;
+        }
+        i++;
+    }
+
+    FILE *out_fp = NULL;
+    int result = 0;
+    if (status == -1) {
+        result = -1;
+    } else if (status != 1 || header.typeflag == LNKTYPE) {
+        fprintf(stderr, "Error: No data for link target of '%s'\n", name);
+        result = -1;
+    } else if ((out_fp = create_extracted_file(name)) == NULL) {
+        perror("Error creating output file");
+        result = -1;
+    } else {
+        result = read_stream_member_data(archive_fp, member_size(&header), out_fp, engine);
+        if (fclose(out_fp) != 0) {
+            perror("Error closing output file");
+            result = -1;
+        }
+    }
+    if (fclose(archive_fp) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+/*
+ * Writes the data of 'version', a version of a link's target that cannot be
+ * linked to, in the seekable archive 'archive_name' read through 'frames', to
+ * a new file for the link 'name'.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int extract_seekable_link_data(const char *archive_name, const frame_table_t *frames,
+                                      const index_entry_t *version, const char *name,
+                                      copy_engine_t *engine) {
+    FILE *archive_fp = compressed_stream_open_at(archive_name, frames, version->offset);
+    if (archive_fp == NULL) {
+        return -1;
+    }
+    tar_header header;
+    FILE *out_fp = NULL;
+    int result = 0;
+    if (read_stream_header(archive_fp, &header) != 1 || header.typeflag == LNKTYPE) {
+        fprintf(stderr, "Error: No data for link target '%s' of '%s'\n", version->name, name);
+        result = -1;
+    } else if ((out_fp = create_extracted_file(name)) == NULL) {
+        perror("Error creating output file");
+        result = -1;
+    } else {
+        result = read_stream_member_data(archive_fp, version->size, out_fp, engine);
+        if (fclose(out_fp) != 0) {
+            perror("Error closing output file");
+            result = -1;
+        }
+    }
+    if (fclose(archive_fp) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+/*
+ * Reads the headers of the compressed archive 'archive_name' in a pass of
+ * their own and checks with check_extract_path the name of every member that
+ * would be extracted: all of them if 'names' is NULL, otherwise those in
+ * 'names'. A plain gzip stream holds no index to check instead, so this is
+ * how an archive with an unsafe name is refused before anything is written.
+ * Returns 0 if every name can be extracted or -1 if not
+ */
+static int check_stream_paths(const char *archive_name, const file_list_t *names,
+                              copy_engine_t *engine) {
+    FILE *archive_fp = open_compressed_archive(archive_name);
+    if (archive_fp == NULL) {
+        return -1;
+    }
+    tar_header header;
+    int status;
+    while ((status = read_stream_header(archive_fp, &header)) == 1) {
+        char member_name[MEMBER_NAME_BUF_LEN];
+        get_member_name(&header, member_name, sizeof(member_name));
+        if ((names == NULL || file_list_contains(names, member_name)) &&
+            check_extract_path(member_name) != 0) {
+            status = -1;
+            break;
+        }
+        if (read_stream_member_data(archive_fp, member_size(&header), NULL, engine) != 0) {
+            status = -1;
+            break;
+        }
+    }
+    if (fclose(archive_fp) != 0) {
+        return -1;
+    }
+    return status;
+}
+
+/*
+ * Walks the compressed archive 'archive_name' from front to back in a single
+ * decompression pass. Every member name is added to 'listed' unless it is
+ * NULL. If 'extract' is nonzero, members are also written to the current
+ * directory: all of them if 'names' is NULL, otherwise only those in 'names'.
+ * If 'index' is not NULL it is the member index of a seekable or dictionary
+ * archive, loaded with 'frames', and only the final version of each member
+ * is written. A plain gzip stream carries no index, so there a member's
+ * later versions overwrite its earlier ones, since the stream cannot be
+ * rewound to find the final version first. A link whose target is not on
+ * disk, because it was not among 'names' or was superseded, is given the
+ * data of the version it refers to by reading the stream again. Before
+ * anything is written, the names to be extracted are checked with
+ * check_extract_path, through 'index' or a header-only pass of their own.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int read_compressed_archive(const char *archive_name, file_list_t *listed, int extract,
+                            const file_list_t *names, const archive_index_t *index,
+                            const frame_table_t *frames) {
+    FILE *archive_fp = index != NULL ? compressed_stream_open_at(archive_name, frames, 0)
+                                     : open_compressed_archive(archive_name);
+    if (archive_fp == NULL) {
+        return -1;
+    }
+    copy_engine_t engine;
+    if (copy_engine_init(&engine, minitar_options.copy_chunk_size) != 0) {
+        fclose(archive_fp);
+        return -1;
+    }
+    if (extract && (index != NULL ? check_index_paths(index)
+                                  : check_stream_paths(archive_name, names, &engine)) != 0) {
+        copy_engine_free(&engine);
+        fclose(archive_fp);
+        return -1;
+    }
+    // Members read so far, recorded by their position in the stream rather
+    // than a byte offset, to check that a link refers to an earlier member
+    // and find the version of its target to read again
+    archive_index_t seen;
+    archive_index_init(&seen);
+
+    tar_header header;
+    int status;
+    while ((status = read_stream_header(archive_fp, &header)) == 1) {
+        char member_name[MEMBER_NAME_BUF_LEN];
+        get_member_name(&header, member_name, sizeof(member_name));
+        if (listed != NULL && file_list_add(listed, member_name) != 0) {
+            perror("Failed to add file to the list");
+            status = -1;
+            break;
+        }
+        if (extract && archive_index_add(&seen, &header, seen.count) != 0) {
+            status = -1;
+            break;
+        }
+        // The index lists members in stream order, so the member just read
+        // is its entry at the same position
+        const index_entry_t *indexed = NULL;
+        if (extract && index != NULL) {
+            if (seen.count > index->count) {
+                fprintf(stderr, "Error: Archive holds more members than its index\n");
+                status = -1;
+                break;
+            }
+            indexed = &index->entries[seen.count - 1];
+            if (archive_index_check_header(indexed, &header) != 0) {
+                status = -1;
+                break;
+            }
+        }
+        // A superseded version is read past without being written
+        int final = indexed == NULL || archive_index_is_final(index, indexed);
+
+        FILE *out_fp = NULL;
+        char *deletions = NULL;
+        size_t deletions_len = 0;
+        if (!final) {
+            // Left to the member's final version
+        } else if (extract && names == NULL && header.typeflag == DELETIONTYPE) {
+            // Read into memory and applied once the whole list has been read,
+            // and only when -g allows deletions; otherwise skipped
+            if (minitar_options.incremental_extract &&
+                (out_fp = open_memstream(&deletions, &deletions_len)) == NULL) {
+                perror("Failed to read deletion manifest");
+                status = -1;
+                break;
+            }
+        } else if (extract && (names == NULL || file_list_contains(names, member_name))) {
+            // A link's target comes before it in the stream, so it already
+            // exists unless it was left out of 'names'
+            if (check_extract_path(member_name) != 0) {
+                status = -1;
+                break;
+            } else if (header.typeflag == LNKTYPE) {
+                const index_entry_t *entry = &seen.entries[seen.count - 1];
+                const index_entry_t *version = link_target_version(&seen, entry, &header);
+                struct stat stat_buf;
+                const index_entry_t *superseded =
+                    indexed != NULL ? superseded_link_target(index, indexed, &header) : NULL;
+                if (check_link_target(&seen, entry, &header) != 0) {
+                    status = -1;
+                } else if (superseded != NULL) {
+                    // The version the link refers to was never written
+                    status = extract_seekable_link_data(archive_name, frames, superseded,
+                                                        member_name, &engine);
+                } else if (names != NULL && lstat(version->name, &stat_buf) != 0) {
+                    status = extract_stream_link_data(archive_name, version->offset,
+                                                      member_name, &engine);
+                } else {
+                    status = extract_link_member(&header, member_name);
+                }
+                if (status != 0) {
+                    status = -1;
+                    break;
+                }
+            } else if (member_is_directory(member_name)) {
+                if (make_member_directories(member_name) != 0) {
+                    status = -1;
+                    break;
+                }
+            } else if ((out_fp = create_extracted_file(member_name)) == NULL) {
+                perror("Error creating output file");
+                status = -1;
+                break;
+            }
+        }
+        status = read_stream_member_data(archive_fp, member_size(&header), out_fp, &engine);
+        if (out_fp != NULL && fclose(out_fp) != 0) {
+            perror("Error closing output file");
+            status = -1;
+        }
+        if (status == 0 && deletions != NULL) {
+            status = apply_deletions(deletions, deletions_len);
+        }
+        free(deletions);
+        if (status != 0) {
+            break;
+        }
+    }
+
+    archive_index_free(&seen);
+    copy_engine_free(&engine);
+    if (fclose(archive_fp) != 0) {
+        return -1;
+    }
+    return status;
+}
+
+/*
+ * Adds the name of every member in 'index' to 'files', in archive order.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int add_index_names(const archive_index_t *index, file_list_t *files) {
+    for (size_t i = 0; i < index->count; i++) {
+        if (file_list_add(files, index->entries[i].name) != 0) {
+            perror("Failed to add file to the list");
+            return -1;
+        }
+    }
+    return 0;
 }
 
-int extract_files_from_archive(const char *archive_name) {
-    // Open the archive file in binary read mode.
-    FILE *archive = fopen(archive_name, "rb");
-    if (!archive) {
-        perror("Error opening archive file");
+/*
+ * Extracts the newest version of each member named in 'files' from the
+ * seekable archive 'archive_name', decompressing only from the frame that
+ * holds each member's header. Links are made once everything else is
+ * extracted, so that a target named alongside them exists to link to.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int extract_seekable_members(const char *archive_name, const archive_index_t *index,
+                             const frame_table_t *frames, const file_list_t *files) {
+    copy_engine_t engine;
+    if (copy_engine_init(&engine, minitar_options.copy_chunk_size) != 0) {
         return -1;
     }
 
-    tar_header header;
-    int end_of_archive = 0;
-    size_t num_read;
-    // Buffer for constructing the full file name. Adjust the size if needed.
-    char full_file_name[256];
-
-    // Process each header block until we hit an empty block (end-of-archive)
-    while (!end_of_archive && (num_read = fread(&header, 1, BLOCK_SIZE, archive)) == BLOCK_SIZE) {
-        // If the block is empty, check if the next block is empty
-        if (is_empty_block((char *) &header)) {
-            // Peek at the next header block
-            long current_pos = ftell(archive);    // Save current position
-            tar_header next_header;
-            if (fread(&next_header, 1, BLOCK_SIZE, archive) != BLOCK_SIZE) {
-                // Couldn't read a full header; assume end of archive
+    int result = 0;
+    for (int links = 0; links <= 1 && result == 0; links++) {
+        for (const node_t *current = files->head; current != NULL && result == 0;
+             current = current->next) {
+            const index_entry_t *entry = archive_index_find(index, current->name);
+            if (entry == NULL) {
+                fprintf(stderr, "Error: '%s' is not present in archive\n", current->name);
+                result = -1;
                 break;
             }
-
-            if (is_empty_block((char *) &next_header)) {
-                // Two consecutive empty blocks found: end of archive.
-                end_of_archive = 1;
+            // Links carry no data, which rules out every other member cheaply
+            if (links && entry->size != 0) {
+                continue;
+            }
+            if (!links && check_extract_path(entry->name) != 0) {
+                result = -1;
+                break;
+            }
+            // Read from the member's header, so that it is verified as well
+            FILE *archive_fp = compressed_stream_open_at(archive_name, frames, entry->offset);
+            if (archive_fp == NULL) {
+                result = -1;
+                break;
+            }
+            tar_header header;
+            FILE *out_fp = NULL;
+            if (read_stream_header(archive_fp, &header) != 1) {
+                fprintf(stderr, "Error: No header for '%s' at its indexed offset\n",
+                        entry->name);
+                result = -1;
+            } else if ((header.typeflag == LNKTYPE) != links) {
+                // Left for the other pass
+            } else if (links && check_link_target(index, entry, &header) != 0) {
+                result = -1;
+            } else if (links) {
+                const index_entry_t *version = unlinkable_link_target(index, entry, &header);
+                result = version == NULL
+                             ? extract_link_member(&header, entry->name)
+                             : extract_seekable_link_data(archive_name, frames, version,
+                                                          entry->name, &engine);
+            } else if (member_is_directory(entry->name)) {
+                result = make_member_directories(entry->name);
+            } else if ((out_fp = create_extracted_file(entry->name)) == NULL) {
+                perror("Error creating output file");
+                result = -1;
             } else {
-                // Not two consecutive empty blocks:
-                // Rewind back one header block so that next_header is processed in the next
-                // iteration.
-                if (fseek(archive, current_pos, SEEK_SET) != 0) {
-                    perror("Error seeking back in archive");
-                    fclose(archive);
-                    return -1;
+                result = read_stream_member_data(archive_fp, entry->size, out_fp, &engine);
+                if (fclose(out_fp) != 0) {
+                    perror("Error closing output file");
+                    result = -1;
                 }
             }
-            continue;
+            if (fclose(archive_fp) != 0) {
+                result = -1;
+            }
         }
+    }
 
-        // Construct the full file name using prefix (if any) and name.
-        if (header.prefix[0] != '\0') {
-            snprintf(full_file_name, sizeof(full_file_name), "%s/%s", header.prefix, header.name);
-        } else {
-            snprintf(full_file_name, sizeof(full_file_name), "%s", header.name);
+    copy_engine_free(&engine);
+    return result;
+}
+
+int get_archive_file_list(const char *archive_name, file_list_t *files) {
+    int compressed = is_compressed_archive(archive_name);
+    if (compressed == -1) {
+        return -1;
+    }
+
+    // A valid index file, or the index inside a seekable archive, already
+    // holds every member name in archive order
+    archive_index_t index;
+    archive_index_init(&index);
+    int loaded;
+    if (compressed) {
+        frame_table_t frames;
+        loaded = seekable_index_load(archive_name, &index, &frames);
+        frame_table_free(&frames);
+        if (loaded == 0) {
+            return read_compressed_archive(archive_name, files, 0, NULL, NULL, NULL);
+        }
+    } else {
+        loaded = archive_index_load(&index, archive_name);
+        if (loaded == 1 && check_indexed_headers(archive_name, index.entries, index.count) != 0) {
+            loaded = -1;
         }
+    }
+    if (loaded != 0) {
+        if (loaded == 1 && add_index_names(&index, files) != 0) {
+            loaded = -1;
+        }
+        archive_index_free(&index);
+        return loaded == 1 ? 0 : -1;
+    }
 
-        // Convert file size from an octal string to a long integer.
-        long file_size = strtol(header.size, NULL, 8);
+    archive_view_t view;
+    if (archive_view_open(&view, archive_name) != 0) {
+        return -1;
+    }
 
-        // Open the output file for writing in binary mode.
-        FILE *out = fopen(full_file_name, "wb");
-        if (!out) {
-            perror("Error creating output file");
-            fclose(archive);    // Ensure we close the archive as well
+    size_t offset = 0;
+    const tar_header *header;
+    int status;
+    while ((status = archive_view_next(&view, &offset, &header)) == 1) {
+        // Add the member's full path to the file list
+        char member_name[MEMBER_NAME_BUF_LEN];
+        get_member_name(header, member_name, sizeof(member_name));
+        if (file_list_add(files, member_name) != 0) {
+            perror("Failed to add file to the list");
+            archive_view_close(&view);
             return -1;
         }
+    }
+
+    archive_view_close(&view);
+    return status;
+}
 
-        // Determine the number of blocks that the file occupies (including padding)
-        int blocks = (file_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-        char buffer[BLOCK_SIZE];
-        long remaining = file_size;    // The actual number of bytes to write
+int extract_files_from_archive(const char *archive_name) {
+    int compressed = is_compressed_archive(archive_name);
+    if (compressed == 1) {
+        // A seekable or dictionary archive's index picks out each member's
+        // final version; a plain gzip stream is extracted in full
+        archive_index_t index;
+        archive_index_init(&index);
+        frame_table_t frames;
+        int loaded = seekable_index_load(archive_name, &index, &frames);
+        int result = -1;
+        if (loaded != -1) {
+            result = read_compressed_archive(archive_name, NULL, 1, NULL,
+                                             loaded == 1 ? &index : NULL, &frames);
+        }
+        frame_table_free(&frames);
+        archive_index_free(&index);
+        return result;
+    } else if (compressed != 0) {
+        return -1;
+    }
 
-        for (int i = 0; i < blocks; i++) {
-            size_t bytes_read = fread(buffer, 1, BLOCK_SIZE, archive);
-            if (bytes_read != BLOCK_SIZE) {
-                perror("Error reading file content from archive");
-                fclose(out);
-                fclose(archive);
-                return -1;
+    // Header-only pre-pass: the index maps each name to its last occurrence,
+    // so superseded versions are skipped instead of written and overwritten
+    archive_index_t index;
+    archive_index_init(&index);
+    if (load_or_build_index(&index, archive_name) != 0 || check_index_paths(&index) != 0) {
+        archive_index_free(&index);
+        return -1;
+    }
+
+    // Deleted paths go first, so that a path which changed between file and
+    // directory is cleared before its new version is written. Files are only
+    // removed when -g asks for incremental extraction, as with GNU tar
+    if (minitar_options.incremental_extract &&
+        apply_deletion_manifest(archive_name, &index) != 0) {
+        archive_index_free(&index);
+        return -1;
+    }
+
+    if (minitar_options.num_threads > 1) {
+        int result = extract_members_parallel(archive_name, &index, minitar_options.num_threads);
+        if (result == 0) {
+            result = extract_link_members(archive_name, &index);
+        }
+        archive_index_free(&index);
+        return result;
+    }
+
+    archive_view_t view;
+    if (archive_view_open(&view, archive_name) != 0) {
+        archive_index_free(&index);
+        return -1;
+    }
+
+    int result = 0;
+    for (size_t i = 0; i < index.count && result == 0; i++) {
+        const index_entry_t *entry = &index.entries[i];
+        if (!archive_index_is_final(&index, entry)) {
+            continue;
+        }
+        const tar_header *header = (const tar_header *) (view.data + entry->offset);
+        if (!archive_index_fits(entry, entry->size, view.size)) {
+            fprintf(stderr, "Error: Archive is truncated\n");
+            result = -1;
+        } else if (archive_index_check_header(entry, header) != 0) {
+            result = -1;
+        } else if (header->typeflag != DELETIONTYPE && header->typeflag != LNKTYPE) {
+            // The deletion manifest was handled up front and links follow
+            // below. The member body sits right after its header in the
+            // mapped pages, so it can be written out without staging it in a buffer
+            result = write_extracted_file(entry->name, view.data + entry->offset + BLOCK_SIZE,
+                                          entry->size);
+        }
+    }
+    if (result == 0) {
+        result = extract_link_members(archive_name, &index);
+    }
+
+    archive_view_close(&view);
+    archive_index_free(&index);
+    return result;
+}
+
+int extract_named_files_from_archive(const char *archive_name, const file_list_t *files) {
+    int compressed = is_compressed_archive(archive_name);
+    if (compressed == 1) {
+        archive_index_t index;
+        archive_index_init(&index);
+        frame_table_t frames;
+        int loaded = seekable_index_load(archive_name, &index, &frames);
+        if (loaded != 0) {
+            int result = -1;
+            if (loaded == 1) {
+                result = extract_seekable_members(archive_name, &index, &frames, files);
             }
-            // For the last block, only write the remaining bytes of the file.
-            size_t to_write = (remaining < BLOCK_SIZE) ? remaining : BLOCK_SIZE;
-            if (fwrite(buffer, 1, to_write, out) != to_write) {
-                perror("Error writing to output file");
-                fclose(out);
-                fclose(archive);
-                return -1;
+            frame_table_free(&frames);
+            archive_index_free(&index);
+            return result;
+        }
+
+        // Extract while listing, then make sure every requested name was seen
+        file_list_t listed;
+        file_list_init(&listed);
+        int result = read_compressed_archive(archive_name, &listed, 1, files, NULL, NULL);
+        for (const node_t *current = files->head; current != NULL && result == 0;
+             current = current->next) {
+            if (!file_list_contains(&listed, current->name)) {
+                fprintf(stderr, "Error: '%s' is not present in archive\n", current->name);
+                result = -1;
             }
-            remaining -= to_write;
         }
-        fclose(out);
+        file_list_clear(&listed);
+        return result;
+    } else if (compressed != 0) {
+        return -1;
     }
 
-    fclose(archive);
-    return 0;
+    // The index gives the offset of each name's newest version; without a
+    // valid index file one is built in memory from a single header walk
+    archive_index_t index;
+    archive_index_init(&index);
+    if (load_or_build_index(&index, archive_name) != 0) {
+        archive_index_free(&index);
+        return -1;
+    }
+
+    archive_view_t view;
+    if (archive_view_open(&view, archive_name) != 0) {
+        archive_index_free(&index);
+        return -1;
+    }
+
+    // Links are made once everything else is extracted, so that a target
+    // named alongside them exists to link to
+    int result = 0;
+    for (int links = 0; links <= 1 && result == 0; links++) {
+        for (const node_t *current = files->head; current != NULL && result == 0;
+             current = current->next) {
+            const index_entry_t *entry = archive_index_find(&index, current->name);
+            if (entry == NULL) {
+                fprintf(stderr, "Error: '%s' is not present in archive\n", current->name);
+                result = -1;
+                break;
+            }
+            // Links carry no data, which rules out every other member cheaply
+            if (links && entry->size != 0) {
+                continue;
+            }
+            if (!links && check_extract_path(entry->name) != 0) {
+                result = -1;
+                break;
+            }
+            const tar_header *header = (const tar_header *) (view.data + entry->offset);
+            if (!archive_index_fits(entry, entry->size, view.size)) {
+                fprintf(stderr, "Error: Archive is truncated\n");
+                result = -1;
+            } else if (archive_index_check_header(entry, header) != 0) {
+                result = -1;
+            } else if ((header->typeflag == LNKTYPE) != links) {
+                continue;
+            } else if (links) {
+                result = extract_mapped_link(&view, &index, entry, header);
+            } else {
+                result = write_extracted_file(entry->name,
+                                              view.data + entry->offset + BLOCK_SIZE,
+                                              entry->size);
+            }
+        }
+    }
+
+    archive_view_close(&view);
+    archive_index_free(&index);
+    return result;
 }
 
 int is_file_in_archive(const char *archive_name, const char *file_name) {
-   FILE *archive_fp = fopen(archive_name, "rb");
-   if (!archive_fp) return -1;
-
-   tar_header header;
-   while (fread(&header, 512, 1, archive_fp) == 1) {
-       if (strcmp(header.name, file_name) == 0) {//do the names match?
-           fclose(archive_fp);
-           return 1;
-       }
-
-       // Skip file contents blocks
-       long file_size;
-       sscanf(header.size, "%lo", &file_size);
-       long blocks = (file_size + 511) / 512; // Round up to nearest block
-       fseek(archive_fp, blocks * 512, SEEK_CUR);
-   }
-
-   if (fclose(archive_fp) != 0) {
-        perror("Error closing file.");
+    int compressed = is_compressed_archive(archive_name);
+    if (compressed == 1) {
+        archive_index_t index;
+        archive_index_init(&index);
+        frame_table_t frames;
+        int loaded = seekable_index_load(archive_name, &index, &frames);
+        frame_table_free(&frames);
+        if (loaded != 0) {
+            int found = archive_index_find(&index, file_name) != NULL;
+            archive_index_free(&index);
+            return loaded == 1 ? found : -1;
+        }
+
+        file_list_t listed;
+        file_list_init(&listed);
+        int result = read_compressed_archive(archive_name, &listed, 0, NULL, NULL, NULL);
+        if (result == 0) {
+            result = file_list_contains(&listed, file_name);
+        }
+        file_list_clear(&listed);
+        return result;
+    } else if (compressed != 0) {
+        return -1;
+    }
+
+    archive_index_t index;
+    archive_index_init(&index);
+    int loaded = archive_index_load(&index, archive_name);
+    if (loaded != 0) {
+        const index_entry_t *entry = archive_index_find(&index, file_name);
+        if (loaded == 1 && entry != NULL && check_indexed_headers(archive_name, entry, 1) != 0) {
+            loaded = -1;
+        }
+        int found = entry != NULL;
+        archive_index_free(&index);
+        return loaded == 1 ? found : -1;
+    }
+
+    archive_view_t view;
+    if (archive_view_open(&view, archive_name) != 0) {
+        return -1;
+    }
+
+    size_t offset = 0;
+    const tar_header *header;
+    int status;
+    char member_name[MEMBER_NAME_BUF_LEN];
+    while ((status = archive_view_next(&view, &offset, &header)) == 1) {
+        get_member_name(header, member_name, sizeof(member_name));
+        if (strcmp(member_name, file_name) == 0) {    // do the names match?
+            break;
+        }
+    }
+
+    archive_view_close(&view);
+    return status;
+}
+
+/*
+ * Compares the contents of the file open as 'fd' with the 'size' bytes of
+ * member data at 'data'.
+ * Returns 1 if they are equal, 0 if they differ, or -1 if an error occurs
+ */
+static int file_matches_data(int fd, const char *data, size_t size) {
+    char buf[COMPARE_BUF_LEN];
+    size_t done = 0;
+    while (done < size) {
+        size_t want = size - done < sizeof(buf) ? size - done : sizeof(buf);
+        ssize_t n = read(fd, buf, want);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            perror("Error reading from file");
+            return -1;
+        }
+        if (n == 0 || memcmp(buf, data + done, n) != 0) {
+            return 0;
+        }
+        done += n;
+    }
+    return 1;
+}
+
+/*
+ * Determines whether the file 'file_name' is unchanged since 'entry', the
+ * newest version of it in the archive 'archive_name' as located by 'index',
+ * was written. Its size and mtime must match the member's, taking a link
+ * member's size from the target version it refers to. Header mtimes only
+ * have whole seconds, so a file modified in the same second as the archive
+ * or later can match while holding new data; such files, and every file with
+ * --compare-content, also have their contents compared with the member's
+ * data, read through 'view', which is mapped on first use.
+ * Returns 1 if the file is unchanged, 0 if it changed, or -1 if an error occurs
+ */
+static int member_is_unchanged(const char *file_name, const archive_index_t *index,
+                               const index_entry_t *entry, const char *archive_name,
+                               const struct stat *archive_stat, archive_view_t *view) {
+    struct stat stat_buf;
+    if (stat(file_name, &stat_buf) != 0) {
+        char err_msg[MAX_MSG_LEN];
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to stat file %s", file_name);
+        perror(err_msg);
+        return -1;
+    }
+    if (!S_ISREG(stat_buf.st_mode) || (int64_t) stat_buf.st_mtime != entry->mtime) {
+        return 0;
+    }
+
+    // A link member stores no data of its own: its contents are those of the
+    // version of its target it was made against
+    const index_entry_t *data_entry = entry;
+    if (entry->size == 0 && stat_buf.st_size != 0) {
+        if (view->data == NULL && archive_view_open(view, archive_name) != 0) {
+            return -1;
+        }
+        if (!archive_index_fits(entry, 0, view->size)) {
+            fprintf(stderr, "Error: Archive is truncated\n");
+            return -1;
+        }
+        const tar_header *header = (const tar_header *) (view->data + entry->offset);
+        if (archive_index_check_header(entry, header) != 0) {
+            return -1;
+        }
+        if (header->typeflag == LNKTYPE &&
+            (data_entry = link_target_version(index, entry, header)) == NULL) {
+            return 0;
+        }
+    }
+    if ((uint64_t) stat_buf.st_size != data_entry->size) {
+        return 0;
+    }
+    if (!minitar_options.compare_content && stat_buf.st_mtime < archive_stat->st_mtime) {
+        return 1;
+    }
+
+    if (view->data == NULL && archive_view_open(view, archive_name) != 0) {
+        return -1;
+    }
+    if (!archive_index_fits(data_entry, data_entry->size, view->size)) {
+        fprintf(stderr, "Error: Archive is truncated\n");
+        return -1;
+    }
+    if (archive_index_check_header(
+            data_entry, (const tar_header *) (view->data + data_entry->offset)) != 0) {
+        return -1;
+    }
+    int fd = open(file_name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Error: Failed to open member file");
         return -1;
     }
-   return 0;
+    int result = file_matches_data(fd, view->data + data_entry->offset + BLOCK_SIZE,
+                                   data_entry->size);
+    close(fd);
+    return result;
 }
 
 int update_archive(const char *archive_name, const file_list_t *files) {
-   const node_t *current = files->head;
-   while (current != NULL) {
-       if (!is_file_in_archive(archive_name, current->name)) {
-           printf("Error: One or more of the specified files is not already present in archive");
-           return -1;
-       }
-       current = current->next;
-   }
-   return append_files_to_archive(archive_name, files);
+    if (check_appendable(archive_name) != 0) {
+        return -1;
+    }
+
+    // One header walk (or a valid index file) yields every member name;
+    // each requested file is then checked against that set in O(1)
+    archive_index_t index;
+    archive_index_init(&index);
+    if (load_or_build_index(&index, archive_name) != 0) {
+        archive_index_free(&index);
+        return -1;
+    }
+
+    const node_t *current = files->head;
+    while (current != NULL) {
+        if (archive_index_find(&index, current->name) == NULL) {
+            printf("Error: One or more of the specified files is not already present in archive");
+            archive_index_free(&index);
+            return -1;
+        }
+        current = current->next;
+    }
+
+    // Only files that changed since their newest version in the archive are
+    // appended again; everything else would add an identical copy
+    struct stat archive_stat;
+    if (stat(archive_name, &archive_stat) != 0) {
+        perror("Failed to stat archive");
+        archive_index_free(&index);
+        return -1;
+    }
+    archive_view_t view = {NULL, 0};
+    file_list_t changed;
+    file_list_init(&changed);
+    size_t num_skipped = 0;
+    uint64_t bytes_saved = 0;
+    int result = 0;
+    for (current = files->head; current != NULL && result == 0; current = current->next) {
+        const index_entry_t *entry = archive_index_find(&index, current->name);
+        int unchanged = member_is_unchanged(current->name, &index, entry, archive_name,
+                                            &archive_stat, &view);
+        if (unchanged == 1) {
+            num_skipped++;
+            bytes_saved += BLOCK_SIZE + (entry->size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        } else if (unchanged == -1) {
+            result = -1;
+        } else if (file_list_add(&changed, current->name) != 0) {
+            fprintf(stderr, "Error: Could not add file '%s' to linked list\n", current->name);
+            result = -1;
+        }
+    }
+    archive_view_close(&view);
+
+    // The names are already known to be present, so append directly and
+    // reuse the index that was just built if the archive keeps one on disk
+    if (result == 0 && changed.size > 0) {
+        result = append_members(archive_name, &changed, NULL,
+                                should_maintain_index(archive_name) ? &index : NULL);
+    }
+    if (result == 0 && num_skipped > 0) {
+        fprintf(stderr, "Update: %zu unchanged member(s) skipped, %llu bytes not rewritten\n",
+                num_skipped, (unsigned long long) bytes_saved);
+    }
+    file_list_clear(&changed);
+    archive_index_free(&index);
+    return result;
 }
 
 // Helper function to print the contents of the file list
@@ -563,3 +2806,267 @@ void print_file_list(const file_list_t *list) {
         printf("%s\n", node->name);
     }
 }
+
+/*
+ * Copies 'len' bytes at 'src_offset' of 'src_fd' to 'dst_offset' of
+ * 'dst_fd', in the kernel with copy_file_range unless it has been found not
+ * to work for these files, and otherwise through the engine's buffer.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int copy_archive_range(copy_engine_t *engine, int src_fd, off_t src_offset, int dst_fd,
+                              off_t dst_offset, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t copied;
+        if (!engine->copy_file_range_failed) {
+            loff_t in = src_offset + done;
+            loff_t out = dst_offset + done;
+            copied = copy_file_range(src_fd, &in, dst_fd, &out, len - done, 0);
+            if (copied < 0 && is_zero_copy_unsupported(errno) && done == 0) {
+                engine->copy_file_range_failed = 1;
+                continue;
+            }
+        } else {
+            size_t want = len - done < engine->chunk_size ? len - done : engine->chunk_size;
+            copied = pread(src_fd, engine->buffer, want, src_offset + done);
+            for (ssize_t written = 0; copied > 0 && written < copied;) {
+                ssize_t w = pwrite(dst_fd, engine->buffer + written, copied - written,
+                                   dst_offset + done + written);
+                if (w < 0) {
+                    copied = -1;
+                    break;
+                }
+                written += w;
+            }
+        }
+        if (copied < 0 && errno == EINTR) {
+            continue;
+        }
+        if (copied < 0) {
+            perror("Error: Failed to copy members to compacted archive");
+            return -1;
+        }
+        if (copied == 0) {
+            fprintf(stderr, "Error: Archive is truncated\n");
+            return -1;
+        }
+        done += copied;
+    }
+    return 0;
+}
+
+/*
+ * Writes the link member 'entry' of 'index', whose header is 'header', at
+ * 'dst_offset' of 'dst_fd' as a regular member holding the data of
+ * 'version', the superseded version of its target that it refers to and that
+ * compaction drops. The rewritten member is added to 'compacted'.
+ * Returns the number of bytes written, or -1 if an error occurs
+ */
+static off_t write_link_as_member(copy_engine_t *engine, int src_fd, int dst_fd,
+                                  off_t dst_offset, const index_entry_t *entry,
+                                  const tar_header *header, const index_entry_t *version,
+                                  archive_index_t *compacted) {
+    tar_header target_header;
+    if (pread(src_fd, &target_header, BLOCK_SIZE, version->offset) != BLOCK_SIZE) {
+        perror("Error reading header from archive");
+        return -1;
+    }
+    if (archive_index_check_header(version, &target_header) != 0) {
+        return -1;
+    }
+    if (target_header.typeflag == LNKTYPE) {
+        fprintf(stderr, "Error: No data for link target '%s' of '%s'\n", version->name,
+                entry->name);
+        return -1;
+    }
+
+    tar_header member = *header;
+    memset(member.linkname, 0, sizeof(member.linkname));
+    if (set_member_size(&member, version->size) != 0) {
+        return -1;
+    }
+    member.typeflag = REGTYPE;
+    compute_checksum(&member);
+    off_t padded = (version->size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    if (pwrite(dst_fd, &member, BLOCK_SIZE, dst_offset) != BLOCK_SIZE) {
+        perror("Error: Failed to copy members to compacted archive");
+        return -1;
+    }
+    if (copy_archive_range(engine, src_fd, version->offset + BLOCK_SIZE, dst_fd,
+                           dst_offset + BLOCK_SIZE, padded) != 0 ||
+        archive_index_add(compacted, &member, dst_offset) != 0) {
+        return -1;
+    }
+    return BLOCK_SIZE + padded;
+}
+
+/*
+ * Writes the newest version of each member in 'index' of the archive open
+ * as 'src_fd' to the empty file 'dst_fd', followed by the footer. Each run
+ * of members that sit next to each other in the archive is copied with one
+ * copy, and links to dropped versions are stored with their data. Kept
+ * members are added to 'compacted' with their new offsets.
+ * Returns the number of bytes written, or -1 if an error occurs
+ */
+static off_t write_compacted_members(int src_fd, int dst_fd, const archive_index_t *index,
+                                     archive_index_t *compacted) {
+    copy_engine_t engine;
+    if (copy_engine_init(&engine, minitar_options.copy_chunk_size) != 0) {
+        return -1;
+    }
+
+    off_t dst_offset = 0;
+    off_t run_start = 0;
+    off_t run_len = 0;
+    int result = 0;
+    for (size_t i = 0; i < index->count && result == 0; i++) {
+        const index_entry_t *entry = &index->entries[i];
+        if (!archive_index_is_final(index, entry)) {
+            continue;
+        }
+        off_t member_len = BLOCK_SIZE + (entry->size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+
+        // A link to a version of its target that is dropped here would lose
+        // its data, so it is stored in full instead. Only members without
+        // data can be links, which spares reading every other header
+        tar_header header;
+        const index_entry_t *version = NULL;
+        if (entry->size == 0) {
+            if (pread(src_fd, &header, BLOCK_SIZE, entry->offset) != BLOCK_SIZE) {
+                perror("Error reading header from archive");
+                result = -1;
+                break;
+            }
+            if (archive_index_check_header(entry, &header) != 0) {
+                result = -1;
+                break;
+            }
+            if (header.typeflag == LNKTYPE) {
+                version = superseded_link_target(index, entry, &header);
+            }
+        }
+
+        if (run_len > 0 && ((off_t) entry->offset != run_start + run_len || version != NULL)) {
+            result = copy_archive_range(&engine, src_fd, run_start, dst_fd,
+                                        dst_offset - run_len, run_len);
+            run_len = 0;
+        }
+        if (result == 0 && version != NULL) {
+            off_t written = write_link_as_member(&engine, src_fd, dst_fd, dst_offset, entry,
+                                                 &header, version, compacted);
+            if (written < 0) {
+                result = -1;
+            } else {
+                dst_offset += written;
+            }
+            continue;
+        }
+        if (run_len == 0) {
+            run_start = entry->offset;
+        }
+        if (result == 0 && archive_index_insert(compacted, entry->name, dst_offset, entry->size,
+                                                entry->mtime, entry->chksum) != 0) {
+            result = -1;
+        }
+        run_len += member_len;
+        dst_offset += member_len;
+    }
+    if (result == 0 && run_len > 0) {
+        result = copy_archive_range(&engine, src_fd, run_start, dst_fd, dst_offset - run_len,
+                                    run_len);
+    }
+    compacted->end_offset = dst_offset;
+
+    // 2 tar footers made of zeroes.
+    char zeros[NUM_TRAILING_BLOCKS * BLOCK_SIZE] = {0};
+    if (result == 0 && pwrite(dst_fd, zeros, sizeof(zeros), dst_offset) != sizeof(zeros)) {
+        perror("Error: Failed to write footer to archive");
+        result = -1;
+    }
+    copy_engine_free(&engine);
+    return result == 0 ? dst_offset + (off_t) sizeof(zeros) : -1;
+}
+
+int compact_archive(const char *archive_name) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int compressed = is_compressed_archive(archive_name);
+    if (compressed != 0) {
+        if (compressed == 1) {
+            fprintf(stderr, "Error: Cannot compact a compressed archive\n");
+        }
+        return -1;
+    }
+
+    // The same header walk that lists the archive finds each name's newest version
+    archive_index_t index;
+    archive_index_init(&index);
+    if (load_or_build_index(&index, archive_name) != 0) {
+        archive_index_free(&index);
+        return -1;
+    }
+
+    int src_fd = open(archive_name, O_RDONLY | O_CLOEXEC);
+    struct stat archive_stat;
+    if (src_fd < 0 || fstat(src_fd, &archive_stat) != 0) {
+        perror("Error opening archive file");
+        if (src_fd >= 0) {
+            close(src_fd);
+        }
+        archive_index_free(&index);
+        return -1;
+    }
+
+    // Written next to the archive, so the rename cannot cross file systems,
+    // and renamed over it only once complete
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", archive_name) >=
+        (int) sizeof(tmp_path)) {
+        fprintf(stderr, "Error: Archive name '%s' is too long\n", archive_name);
+        close(src_fd);
+        archive_index_free(&index);
+        return -1;
+    }
+    int dst_fd = mkstemp(tmp_path);
+    if (dst_fd < 0) {
+        perror("Failed to create compacted archive");
+        close(src_fd);
+        archive_index_free(&index);
+        return -1;
+    }
+
+    archive_index_t compacted;
+    archive_index_init(&compacted);
+    off_t new_size = write_compacted_members(src_fd, dst_fd, &index, &compacted);
+    int result = new_size < 0 ? -1 : 0;
+    if (result == 0 && (fchmod(dst_fd, archive_stat.st_mode & 07777) != 0 ||
+                        fsync(dst_fd) != 0)) {
+        perror("Failed to write compacted archive");
+        result = -1;
+    }
+    if (close(dst_fd) != 0) {
+        perror("Error closing file.");
+        result = -1;
+    }
+    close(src_fd);
+    if (result == 0 && rename(tmp_path, archive_name) != 0) {
+        perror("Failed to replace archive with compacted archive");
+        result = -1;
+    }
+    if (result != 0) {
+        unlink(tmp_path);
+    } else if (should_maintain_index(archive_name)) {
+        result = archive_index_save(&compacted, archive_name);
+    }
+
+    if (result == 0) {
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fprintf(stderr, "Compact: kept %zu of %zu member(s), reclaimed %lld bytes in %.3f s\n",
+                compacted.count, index.count, (long long) (archive_stat.st_size - new_size),
+                (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    }
+    archive_index_free(&compacted);
+    archive_index_free(&index);
+    return result;
+}
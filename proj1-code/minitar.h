@@ -2,6 +2,12 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #ifndef _MINITAR_H
 #define _MINITAR_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "dedup.h"
 #include "file_list.h"
 
 // Standard tar header layout defined by POSIX
@@ -41,9 +47,94 @@ typedef struct {
     char padding[12];
 } tar_header;
 
+// Size of a header block and the unit all member data is padded to
+#define BLOCK_SIZE 512
+
+// Room for the longest path a header can hold: 155-byte prefix, '/', 100-byte name, NUL
+#define MEMBER_NAME_BUF_LEN 257
+
+// Default amount of member data moved per read/write by the copy engine (1 MiB)
+#define DEFAULT_COPY_CHUNK_SIZE (1 << 20)
+
+// Name and type of the member in which an incremental (-g) archive lists the
+// paths deleted since the previous run, as NUL-terminated strings. The type
+// is not a POSIX one, so other tars extract the list as an ordinary file.
+#define DELETIONS_NAME ".minitar-deleted"
+#define DELETIONTYPE 'R'
+
+// Type of a member stored as a hard link to the earlier member named in its
+// linkname field, as --dedup writes repeated contents
+#define LNKTYPE '1'
+
+// Settings that tune the archive operations below.
+// Defaults live in minitar.c; minitar_main.c overrides them from the command line.
+typedef struct {
+    // Bytes moved per chunk when copying member data, a multiple of 512
+    size_t copy_chunk_size;
+    // Nonzero to move member data with copy_file_range/sendfile instead of a user-space buffer
+    int zero_copy;
+    // Nonzero to create and maintain a sidecar index file next to the archive
+    int use_index;
+    // Number of worker threads used to prepare members during create and append,
+    // to compress -z archives during create, and to write out members during extraction
+    int num_threads;
+    // Nonzero to create archives by preallocating them and writing members in place
+    int preallocate;
+    // Nonzero to gzip-compress archives as they are created
+    int compress;
+    // Nonzero to make compressed archives seekable: compressed in independent
+    // frames, with a frame table and member index stored at the end
+    int seekable;
+    // Nonzero to compress each member as its own frame against a dictionary
+    // sampled from the members being archived
+    int dictionary;
+    // Nonzero to store only numeric owner and group IDs, leaving the names
+    // empty, so no user or group database is consulted
+    int numeric_owner;
+    // Nonzero to make update compare file contents with the archived members
+    // whenever size and mtime match, rather than trusting the metadata
+    int compare_content;
+    // Snapshot file of an incremental (-g) create, or NULL for a full one
+    const char *snapshot_file;
+    // Nonzero to let extraction apply the deletion manifests of incremental
+    // archives (-g on -x)
+    int incremental_extract;
+    // Nonzero to store a regular file whose contents repeat those of a member
+    // already written by the same operation as a hard link to that member
+    int dedup;
+} minitar_options_t;
+
+extern minitar_options_t minitar_options;
+
+// Staging buffer shared by every member written during one archive operation
+typedef struct {
+    char *buffer;
+    size_t chunk_size;
+    // Set once the kernel has refused a zero-copy primitive for this archive
+    int copy_file_range_failed;
+    int sendfile_failed;
+    // Number of members with data whose payload went through each copy path
+    unsigned long num_copy_file_range;
+    unsigned long num_sendfile;
+    unsigned long num_buffered;
+    // Members written in full so far, and the repeats stored as links to them
+    dedup_table_t dedup;
+    // Nonzero when the archive is a regular file, so --dedup can digest a
+    // member while copying it and turn it into a link afterwards rather than
+    // reading it once more beforehand
+    int dedup_after_copy;
+    unsigned long num_dedup_links;
+    unsigned long long dedup_bytes;
+} copy_engine_t;
+
 /*
  * Create a new archive file with the name 'archive_name'.
- * The archive should contain all files stored in the 'files' list.
+ * The archive should contain all files stored in the 'files' list. A
+ * directory in the list is stored as a directory entry followed by
+ * everything beneath it.
+ * With a snapshot file set (-g), only files that are new or changed since
+ * the snapshot was written are stored, along with a deletion manifest
+ * naming the paths that have gone, and the snapshot is then replaced.
  * You can assume in this project that at least one member file is specified.
  * You may also assume that all the elements of 'files' exist.
  * If an archive of the specified name already exists, you should overwrite it
@@ -54,6 +145,7 @@ int create_archive(const char *archive_name, const file_list_t *files);
 
 /*
  * Append each file specified in 'files' to the archive with the name 'archive_name'.
+ * Directories are expanded as for create_archive.
  * You can assume in this project that at least one new file to append is specified.
  * You may also assume that all files to be appended exist.
  * This function should return 0 upon success or -1 if an error occurred.
@@ -74,24 +166,125 @@ int get_archive_file_list(const char *archive_name, file_list_t *files);
  * as a new file to the current working directory.
  * If there are multiple versions of the same file present in the archive,
  * then only the most recently added version should be present as a new file
- * at the end of the extraction process.
+ * at the end of the extraction process. A header-only pass finds that
+ * version first, so older versions are never written; a seekable or
+ * dictionary-compressed archive's member index is used the same way. A plain
+ * gzip stream has no index and cannot be rewound, so there older versions
+ * are written and then overwritten. The paths listed in a
+ * deletion manifest are removed before anything is written, so extracting a
+ * full archive and then each increment in order restores the latest state.
+ * An archive with a member named outside the current working directory is
+ * refused before anything is written.
  * This function should return 0 upon success or -1 if an error occurred.
  */
 int extract_files_from_archive(const char *archive_name);
 
-// NEED TO CREATE COMMENT
+/*
+ * Write the most recently added version of each file named in 'files' from
+ * the archive identified by 'archive_name' to the current working directory.
+ * Members are located through the archive's index file when it is valid.
+ * This function should return 0 upon success or -1 if an error occurred
+ * (including when a requested file is not in the archive).
+ */
+int extract_named_files_from_archive(const char *archive_name, const file_list_t *files);
+
+/*
+ * Determine whether a member named 'file_name' is present in the archive
+ * identified by 'archive_name'.
+ * Returns 1 if it is present, 0 if it is not, or -1 if an error occurred.
+ */
 int is_file_in_archive(const char *archive_name, const char *file_name);
 
+// Read-only view of an entire archive file mapped into memory
+typedef struct {
+    const char *data;
+    size_t size;
+} archive_view_t;
+
+/*
+ * Map the archive identified by 'archive_name' into memory so its headers
+ * can be read in place.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int archive_view_open(archive_view_t *view, const char *archive_name);
+
+// Unmap an archive previously opened with archive_view_open
+void archive_view_close(archive_view_t *view);
+
+/*
+ * Advance to the next member header at or after byte '*offset' of 'view'.
+ * On success '*header' points into the mapping (the member's data follows it
+ * directly) and '*offset' is moved past the member's padded data.
+ * Returns 1 if a header was found, 0 at the end of the archive, or -1 if the
+ * archive is truncated.
+ */
+int archive_view_next(const archive_view_t *view, size_t *offset, const tar_header **header);
+
+// Convert a 0-padded octal header field of at most 'len' bytes to a number
+unsigned long long parse_octal(const char *field, size_t len);
+
+/*
+ * Check the checksum stored in 'header' against the sum of its bytes, taken
+ * either as unsigned values (POSIX) or as signed ones (some older tars).
+ * Returns 1 if it matches, 0 if the header is corrupt
+ */
+int verify_checksum(const tar_header *header);
+
+// Return the size in bytes of the data of the member described by 'header'
+size_t member_size(const tar_header *header);
+
+// Largest member size the 11 octal digits of the size field hold (8 GiB - 1)
+#define MAX_MEMBER_SIZE 077777777777ULL
+
+/*
+ * Store 'size' in the size field of 'header', whose name is already set, as
+ * 0-padded octal.
+ * Returns 0 on success or -1 with errno set to EFBIG if the size does not
+ * fit in the field.
+ */
+int set_member_size(tar_header *header, unsigned long long size);
+
+// Write the member's full path (prefix and name fields joined) into 'buf'
+void get_member_name(const tar_header *header, char *buf, size_t buf_len);
+
+// Returns 1 if the member named 'name' is a directory (its name ends in '/'), 0 otherwise
+int member_is_directory(const char *name);
+
+// Returns 1 if the path 'path' from an archive stays inside the directory it is
+// extracted to, being relative and free of ".." components, 0 otherwise
+int is_contained_path(const char *path);
+
+/*
+ * Check that the member named 'name' can be extracted without leaving the
+ * directory it is extracted to, reporting it if it cannot. Must be called
+ * before anything is created or removed under the name.
+ * Returns 0 if it can be extracted or -1 if not
+ */
+int check_extract_path(const char *name);
+
+// Returns 1 if a directory leading up to the last '/' in 'path' is a
+// symbolic link on disk, 0 otherwise
+int has_symlinked_parent(const char *path);
+
+/*
+ * Create every directory leading up to the last '/' in the member name
+ * 'name', so a directory member ("a/b/") is created along with its parents
+ * and a file member ("a/b/f") gets the directories it goes in. Directories
+ * that already exist are kept. 'name' must have passed check_extract_path.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int make_member_directories(const char *name);
+
 /**
  * is_empty_block - Determine if a memory block is completely empty.
  * @block: Pointer to the memory block to be checked. The block is assumed to
  *         be of size BLOCK_SIZE bytes.
  *
  * Description:
- *   This function iterates over a memory block of size BLOCK_SIZE bytes and
- *   checks whether every byte in the block is zero ('\0'). This is useful,
- *   for example, when verifying whether a 512-byte tar header block is empty,
- *   which indicates the end of the archive.
+ *   This function checks whether every byte in a memory block of size
+ *   BLOCK_SIZE bytes is zero ('\0'), using the vectorized zero_block_run from
+ *   block_ops.h. This is useful, for example, when verifying whether a
+ *   512-byte tar header block is empty, which indicates the end of the archive.
  *
  * Return:
  *   1 if the block is entirely empty (all bytes are zero),
@@ -100,9 +293,111 @@ int is_file_in_archive(const char *archive_name, const char *file_name);
 int is_empty_block(const char *block);
 
 /*
+ * Print each name in 'list' on its own line, in list order.
  */
 void print_file_list(const file_list_t *list);
 
+/*
+ * Append new versions of the files in 'files' to the archive identified by
+ * 'archive_name'. Every file must already be present in the archive; the
+ * archive's headers are read once to check all of them. Files whose size
+ * and mtime still match their newest member (and whose contents do too,
+ * when the mtime cannot rule out a change) are not appended again.
+ * This function should return 0 upon success or -1 if an error occurred
+ * (including when a file is not already present).
+ */
 int update_archive(const char *archive_name, const file_list_t *files);
 
+/*
+ * Rewrite the archive identified by 'archive_name' so that it holds only the
+ * most recently added version of each member, in archive order, dropping the
+ * older versions left behind by append and update. Member data is moved in
+ * the kernel where possible, and the new archive is written to a temporary
+ * file that replaces the archive only once it is complete. The bytes
+ * reclaimed and the time taken are reported.
+ * This function should return 0 upon success or -1 if an error occurred.
+ */
+int compact_archive(const char *archive_name);
+
+/*
+ * Helpers shared by the serial writer in minitar.c and the threaded writer
+ * in parallel.c
+ */
+
+/*
+ * Populate 'header' with metadata about the file identified by 'file_name'.
+ * Safe to call from several threads at once.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int fill_tar_header(tar_header *header, const char *file_name);
+
+/*
+ * Open the file identified by 'file_name' for reading, or take over 'fd' if
+ * it is already open as that descriptor rather than -1, and populate
+ * 'header' (and 'stat_buf', unless it is NULL) from the open descriptor's
+ * metadata, so the header describes exactly the file whose data will be
+ * copied and its path is resolved only once. Several threads may call this
+ * at once for different members.
+ * Returns the descriptor, which the caller must close, or -1 if an error occurred.
+ */
+int open_member(const char *file_name, int fd, tar_header *header, struct stat *stat_buf);
+
+/*
+ * With --dedup, determine whether the member described by 'header' and
+ * 'stat_buf', with content digest 'digest' and data held in 'payload' or,
+ * if that is NULL, read from 'file_fd', repeats the contents of a regular
+ * member 'engine' has already written. If so 'header' is turned into a hard
+ * link to that member and none of its data needs to be written; otherwise
+ * the member is remembered for later ones. Must be called in archive order.
+ * Returns 1 if the member became a link, 0 if not, or -1 if an error occurred.
+ */
+int dedup_member(copy_engine_t *engine, tar_header *header, const struct stat *stat_buf,
+                 uint32_t digest, int file_fd, const char *payload);
+
+/*
+ * Create the hard link member 'name' described by 'header', linking it to
+ * the already extracted file named in the header's linkname field, or
+ * copying that file where the file system cannot link it. A link to its own
+ * name leaves the version already extracted there in place.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int extract_link_member(const tar_header *header, const char *name);
+
+/*
+ * Forget the owner and group names fill_tar_header has cached. Names are
+ * looked up once per ID and kept until this is called at the end of a run.
+ */
+void owner_name_cache_clear(void);
+
+/*
+ * Determine whether a copy_file_range/sendfile failure with errno 'err' means
+ * the kernel or filesystem cannot copy between the descriptors in the kernel,
+ * rather than a genuine I/O error.
+ */
+int is_zero_copy_unsupported(int err);
+
+/*
+ * Copy exactly the member size recorded in 'header' from 'file_fd', the
+ * descriptor returned by open_member, to the current position of
+ * 'archive_fp' and zero-pad it to a whole number of blocks, using the
+ * zero-copy path when it is enabled. A file that shrank is zero-filled and
+ * one that grew is cut off, so the data always matches the header.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int write_member_payload(FILE *archive_fp, int file_fd, const tar_header *header,
+                         copy_engine_t *engine);
+
+/*
+ * With --dedup on an archive where engine->dedup_after_copy is set, write
+ * 'header' and the data of 'file_fd' to 'archive_fp', taking the data's
+ * digest as it is copied. If the data then turns out to repeat an earlier
+ * member, the header is rewritten as a link to it and the stream is left
+ * just after the header, so the next member overwrites the data.
+ * 'header' is left as it stands in the archive. Must be called in archive
+ * order.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int write_member_then_dedup(FILE *archive_fp, int file_fd, tar_header *header,
+                            const struct stat *stat_buf, copy_engine_t *engine);
+
 #endif    // _MINITAR_H
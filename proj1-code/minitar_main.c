@@ -1,14 +1,19 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "file_list.h"
 #include "minitar.h"
+#include "parallel.h"
+
+// Largest accepted -b value, which caps copy chunks at 64 MiB
+#define MAX_BLOCKING_FACTOR 131072
 
 // argc is the argument count and argv is the string of arguments
-// Usage: ./minitar <operation> -f <archive_name> <file_name_1> <file_name_2> ... <file_name_n>
+// Usage: ./minitar <operation> [options] -f <archive_name> <file_name_1> <file_name_2> ... <file_name_n>
 int main(int argc, char **argv) {
     if (argc < 4) {
-        fprintf(stderr, "Usage: %s -c|a|t|u|x -f ARCHIVE [FILE...]\n", argv[0]);
+        fprintf(stderr, "Usage: %s -c|a|t|u|x|--compact [-b BLOCKS] [-j THREADS] [--zero-copy] [--preallocate] [--index] [-z] [--seekable] [--dictionary] [--numeric-owner] [--compare-content] [-g SNAPSHOT (with -c) | -g (with -x)] [--dedup] -f ARCHIVE [FILE...]\n", argv[0]);
         return 1;
     }
 
@@ -16,24 +21,129 @@ int main(int argc, char **argv) {
     char *operation = argv[1];
     if (strcmp(operation, "-c") != 0 && strcmp(operation, "-a") != 0 &&
         strcmp(operation, "-t") != 0 && strcmp(operation, "-u") != 0 &&
-        strcmp(operation, "-x") != 0) {
+        strcmp(operation, "-x") != 0 && strcmp(operation, "--compact") != 0) {
         fprintf(stderr, "Error: Invalid operation flag '%s'\n", operation);
         return 1;
     }
 
+    // Parse any options that appear between the operation and the -f flag
+    int arg = 2;
+    while (arg < argc && strcmp(argv[arg], "-f") != 0) {
+        if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc) {
+            // Blocking factor: number of 512-byte blocks moved per copy chunk
+            char *end;
+            long blocks = strtol(argv[arg + 1], &end, 10);
+            if (*end != '\0' || blocks <= 0 || blocks > MAX_BLOCKING_FACTOR) {
+                fprintf(stderr, "Error: Invalid blocking factor '%s'\n", argv[arg + 1]);
+                return 1;
+            }
+            minitar_options.copy_chunk_size = (size_t) blocks * 512;
+            arg += 2;
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            // Number of worker threads preparing members in parallel
+            char *end;
+            long threads = strtol(argv[arg + 1], &end, 10);
+            if (*end != '\0' || threads <= 0 || threads > MAX_THREADS) {
+                fprintf(stderr, "Error: Invalid thread count '%s'\n", argv[arg + 1]);
+                return 1;
+            }
+            minitar_options.num_threads = threads;
+            arg += 2;
+        } else if (strcmp(argv[arg], "-g") == 0 && strcmp(operation, "-x") == 0) {
+            // On extract, apply the deletions recorded by incremental creates
+            minitar_options.incremental_extract = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "-g") == 0 && arg + 1 < argc) {
+            // Incremental create against a snapshot file of the previous run
+            minitar_options.snapshot_file = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "--dedup") == 0) {
+            // Store repeated file contents once, with hard links to the first copy
+            minitar_options.dedup = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--zero-copy") == 0) {
+            minitar_options.zero_copy = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--preallocate") == 0) {
+            minitar_options.preallocate = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--index") == 0) {
+            minitar_options.use_index = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "-z") == 0) {
+            // Compress with gzip on create; compressed archives are detected when read
+            minitar_options.compress = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--seekable") == 0) {
+            // Seekable compressed archives; implies -z
+            minitar_options.compress = 1;
+            minitar_options.seekable = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--dictionary") == 0) {
+            // Per-member frames sharing a trained dictionary; implies -z
+            minitar_options.compress = 1;
+            minitar_options.dictionary = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--compare-content") == 0) {
+            // Update checks contents as well as size and mtime
+            minitar_options.compare_content = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--numeric-owner") == 0) {
+            // Store uid/gid only, without user or group database lookups
+            minitar_options.numeric_owner = 1;
+            arg++;
+        } else {
+            fprintf(stderr, "Error: Invalid option '%s'\n", argv[arg]);
+            return 1;
+        }
+    }
+
+    // A gzip stream can only be written front to back in one pass
+    if (minitar_options.compress) {
+        if (strcmp(operation, "-a") == 0 || strcmp(operation, "-u") == 0 ||
+            strcmp(operation, "--compact") == 0) {
+            fprintf(stderr, "Error: -z cannot be used with '%s'\n", operation);
+            return 1;
+        }
+        if (minitar_options.zero_copy || minitar_options.preallocate ||
+            minitar_options.use_index) {
+            fprintf(stderr, "Error: -z cannot be combined with --zero-copy, --preallocate or --index\n");
+            return 1;
+        }
+    }
+
+    // The snapshot describes what a create stored; preallocated archives are
+    // laid out before anything could be left out of them
+    if (minitar_options.snapshot_file != NULL) {
+        if (strcmp(operation, "-c") != 0) {
+            fprintf(stderr, "Error: -g can only be used with -c or -x\n");
+            return 1;
+        }
+        if (minitar_options.preallocate) {
+            fprintf(stderr, "Error: -g cannot be combined with --preallocate\n");
+            return 1;
+        }
+    }
+
+    // Preallocated archives are laid out before any contents are compared
+    if (minitar_options.dedup && minitar_options.preallocate) {
+        fprintf(stderr, "Error: --dedup cannot be combined with --preallocate\n");
+        return 1;
+    }
+
     // Validate -f flag
-    if (strcmp(argv[2], "-f") != 0) {
+    if (arg + 1 >= argc) {
         fprintf(stderr, "Error: missing -f flag\n");
         return 1;
     }
 
     // Set archive name and initialize the file list
-    char *archive_name = argv[3];
+    char *archive_name = argv[arg + 1];
     file_list_t files;
     file_list_init(&files);
 
     // Add any additional file arguments to the linked list
-    for (int i = 4; i < argc; i++) {
+    for (int i = arg + 2; i < argc; i++) {
         if (file_list_add(&files, argv[i]) != 0) {
             fprintf(stderr, "Error: Could not add file '%s' to linked list\n", argv[i]);
             file_list_clear(&files);
@@ -62,36 +172,38 @@ int main(int argc, char **argv) {
             // Print the list to the terminal
             print_file_list(&files);
         }
-    } else if (strcmp(operation, "-u") == 0) {    /// LOOK HERE FOR UPDATE FUNCTION.
-        // Check if all files are present in the archive
-        const node_t *current = files.head;
-        while (current != NULL) {
-            int check = is_file_in_archive(archive_name, current->name);
-            if (check == -1) { //error checking
-                fprintf(stderr, "Error: Failed to check if file '%s' exists in archive.\n", current->name);
-                file_list_clear(&files);
-                return 1;
-            } else if (check == 0) {
-                printf("Error: One or more of the specified files is not already present in archive");
-                file_list_clear(&files);
-                return 1;
-            }
-            current = current->next;
-        }
-        // Call update function
+    } else if (strcmp(operation, "-u") == 0) {
+        // update_archive checks that every file is already present before appending
         if (update_archive(archive_name, &files) != 0) {
             file_list_clear(&files);
+            owner_name_cache_clear();
             return 1;
         }
-        
+    } else if (strcmp(operation, "--compact") == 0) {
+        // Keep only the newest version of each member
+        if (files.size > 0) {
+            fprintf(stderr, "Error: --compact does not take file names\n");
+            result = -1;
+        } else {
+            result = compact_archive(archive_name);
+        }
+        if (result != 0) {
+            fprintf(stderr, "Error: Failed to compact archive.\n");
+        }
     } else if (strcmp(operation, "-x") == 0) {
-        result = extract_files_from_archive(archive_name);
+        // Extract only the named members if any were given, otherwise everything
+        if (files.size > 0) {
+            result = extract_named_files_from_archive(archive_name, &files);
+        } else {
+            result = extract_files_from_archive(archive_name);
+        }
         if (result != 0) {
             fprintf(stderr, "Error: Failed to extract files from archive.\n");
         }
     }
 
     file_list_clear(&files);
+    owner_name_cache_clear();
 
     if (result != 0) {
         fprintf(stderr, "Error: Archive operation failed.\n");
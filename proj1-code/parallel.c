@@ -0,0 +1,764 @@
+#define _GNU_SOURCE
+#include "parallel.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Members up to this size are read in full by a worker; larger ones are
+// streamed by the writer so memory use stays bounded by the window
+#define PREFETCH_MAX_SIZE (1 << 20)
+// Number of members that may be in flight per worker thread
+#define JOBS_PER_THREAD 4
+
+// States of one slot in the window of in-flight members
+enum { JOB_EMPTY, JOB_BUSY, JOB_READY, JOB_FAILED };
+
+typedef struct {
+    // Position of the member in the file list
+    size_t position;
+    tar_header header;
+    // Metadata the header was filled from, and with --dedup the digest of
+    // the member's data
+    struct stat stat_buf;
+    uint32_t digest;
+    // Descriptor the header was filled from, kept open until the data is
+    // copied from it, or -1 once closed
+    int fd;
+    // Member data padded to whole blocks, or NULL if the writer streams it
+    char *payload;
+    size_t payload_len;
+    int state;
+} member_job_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    // Signalled when a worker finishes a job
+    pthread_cond_t job_done;
+    // Signalled when the writer frees a slot in the window
+    pthread_cond_t slot_free;
+    // Next file for a worker to pick up, and its position in the list
+    const node_t *next_node;
+    size_t next_position;
+    // Descriptors the walk left open, by position, or NULL
+    held_files_t *held;
+    // Position of the next member the writer will emit
+    size_t written;
+    member_job_t *window;
+    size_t window_size;
+    // Set when the writer takes the digest of streamed members as it copies
+    // them, so workers only digest the members they read in full
+    int dedup_after_copy;
+    // Set when the writer gives up so idle workers exit
+    int abort;
+} create_pipeline_t;
+
+/*
+ * Reads all of 'job's data from its descriptor into a block-padded buffer if
+ * it is small enough, then closes the descriptor. A file that shrank since
+ * it was stat'ed is zero-filled up to the size in its header, exactly as the
+ * serial path does.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int prefetch_payload(member_job_t *job) {
+    size_t size = member_size(&job->header);
+    if (size > PREFETCH_MAX_SIZE) {
+        return 0;
+    }
+
+    job->payload_len = (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    job->payload = calloc(1, job->payload_len > 0 ? job->payload_len : 1);
+    if (job->payload == NULL) {
+        perror("Failed to allocate member buffer");
+        return -1;
+    }
+
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = read(job->fd, job->payload + total, size - total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            perror("Error reading from file");
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        total += n;
+    }
+    int fd = job->fd;
+    job->fd = -1;
+    if (close(fd) != 0) {
+        perror("Error closing file.");
+        return -1;
+    }
+    return 0;
+}
+
+// Determines whether --dedup may store 'job' as a link to an earlier member
+static int is_dedup_candidate(const member_job_t *job) {
+    return minitar_options.dedup && S_ISREG(job->stat_buf.st_mode) &&
+           member_size(&job->header) > 0;
+}
+
+static void *create_worker(void *arg) {
+    create_pipeline_t *pipeline = arg;
+    for (;;) {
+        pthread_mutex_lock(&pipeline->lock);
+        // Stay at most one window ahead of the writer
+        while (!pipeline->abort && pipeline->next_node != NULL &&
+               pipeline->next_position >= pipeline->written + pipeline->window_size) {
+            pthread_cond_wait(&pipeline->slot_free, &pipeline->lock);
+        }
+        if (pipeline->abort || pipeline->next_node == NULL) {
+            pthread_mutex_unlock(&pipeline->lock);
+            return NULL;
+        }
+        member_job_t *job = &pipeline->window[pipeline->next_position % pipeline->window_size];
+        const node_t *node = pipeline->next_node;
+        job->position = pipeline->next_position;
+        job->payload = NULL;
+        job->payload_len = 0;
+        job->fd = -1;
+        job->state = JOB_BUSY;
+        pipeline->next_node = pipeline->next_node->next;
+        pipeline->next_position++;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        int failed = 0;
+        int held_fd = held_files_take(pipeline->held, job->position);
+        if ((job->fd = open_member(node->name, held_fd, &job->header, &job->stat_buf)) < 0) {
+            perror("Error: Failed to create tar header");
+            failed = 1;
+        } else if (prefetch_payload(job) != 0) {
+            failed = 1;
+        } else if (is_dedup_candidate(job)) {
+            // Digests are taken here so the writer only compares them
+            size_t size = member_size(&job->header);
+            if (job->payload != NULL) {
+                job->digest = dedup_digest(job->payload, size);
+            } else if (!pipeline->dedup_after_copy &&
+                       dedup_digest_fd(job->fd, size, &job->digest) != 0) {
+                failed = 1;
+            }
+        }
+
+        pthread_mutex_lock(&pipeline->lock);
+        job->state = failed ? JOB_FAILED : JOB_READY;
+        pthread_cond_broadcast(&pipeline->job_done);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+}
+
+/*
+ * Appends one prepared member to the archive.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int write_job(FILE *archive_fp, member_job_t *job, archive_index_t *index,
+                     copy_engine_t *engine) {
+    off_t header_offset = ftello(archive_fp);
+    // Streamed members are digested as they are copied, then linked if repeats
+    if (is_dedup_candidate(job) && job->payload == NULL && engine->dedup_after_copy) {
+        if (write_member_then_dedup(archive_fp, job->fd, &job->header, &job->stat_buf,
+                                    engine) != 0 ||
+            (index != NULL && archive_index_add(index, &job->header, header_offset) != 0)) {
+            return -1;
+        }
+        return 0;
+    }
+
+    // Checked here, in archive order, so a link always follows its target
+    int linked = 0;
+    if (is_dedup_candidate(job) &&
+        (linked = dedup_member(engine, &job->header, &job->stat_buf, job->digest, job->fd,
+                               job->payload)) < 0) {
+        return -1;
+    }
+
+    if (fwrite(&job->header, BLOCK_SIZE, 1, archive_fp) != 1) {
+        perror("Error: Failed to write header to archive");
+        return -1;
+    }
+    // A link carries no data
+    if (!linked && job->payload != NULL) {
+        if (job->payload_len > 0) {
+            if (fwrite(job->payload, job->payload_len, 1, archive_fp) != 1) {
+                perror("Error: Failed to write file contents to archive");
+                return -1;
+            }
+            engine->num_buffered++;
+        }
+    } else if (!linked &&
+               write_member_payload(archive_fp, job->fd, &job->header, engine) != 0) {
+        return -1;
+    }
+    if (index != NULL && archive_index_add(index, &job->header, header_offset) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int write_members_parallel(FILE *archive_fp, const file_list_t *files, held_files_t *held,
+                           archive_index_t *index, copy_engine_t *engine, int num_threads) {
+    create_pipeline_t pipeline;
+    pipeline.next_node = files->head;
+    pipeline.next_position = 0;
+    pipeline.held = held;
+    pipeline.written = 0;
+    pipeline.dedup_after_copy = engine->dedup_after_copy;
+    pipeline.abort = 0;
+    pipeline.window_size = (size_t) num_threads * JOBS_PER_THREAD;
+    pipeline.window = calloc(pipeline.window_size, sizeof(member_job_t));
+    if (pipeline.window == NULL) {
+        perror("Failed to allocate member window");
+        return -1;
+    }
+    for (size_t i = 0; i < pipeline.window_size; i++) {
+        pipeline.window[i].fd = -1;
+    }
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    if (threads == NULL) {
+        perror("Failed to allocate worker threads");
+        free(pipeline.window);
+        return -1;
+    }
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.job_done, NULL);
+    pthread_cond_init(&pipeline.slot_free, NULL);
+
+    int num_started = 0;
+    for (; num_started < num_threads; num_started++) {
+        if (pthread_create(&threads[num_started], NULL, create_worker, &pipeline) != 0) {
+            break;
+        }
+    }
+
+    int result = num_started > 0 ? 0 : -1;
+    for (size_t position = 0; result == 0 && position < (size_t) files->size; position++) {
+        member_job_t *job = &pipeline.window[position % pipeline.window_size];
+
+        pthread_mutex_lock(&pipeline.lock);
+        while (job->position != position || (job->state != JOB_READY && job->state != JOB_FAILED)) {
+            pthread_cond_wait(&pipeline.job_done, &pipeline.lock);
+        }
+        pthread_mutex_unlock(&pipeline.lock);
+
+        if (job->state == JOB_FAILED || write_job(archive_fp, job, index, engine) != 0) {
+            result = -1;
+        }
+        free(job->payload);
+        job->payload = NULL;
+        if (job->fd >= 0) {
+            close(job->fd);
+            job->fd = -1;
+        }
+
+        pthread_mutex_lock(&pipeline.lock);
+        job->state = JOB_EMPTY;
+        pipeline.written++;
+        pthread_cond_broadcast(&pipeline.slot_free);
+        pthread_mutex_unlock(&pipeline.lock);
+    }
+
+    // Stop workers still waiting for room, then release whatever they prepared
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.abort = 1;
+    pthread_cond_broadcast(&pipeline.slot_free);
+    pthread_mutex_unlock(&pipeline.lock);
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (size_t i = 0; i < pipeline.window_size; i++) {
+        free(pipeline.window[i].payload);
+        if (pipeline.window[i].fd >= 0) {
+            close(pipeline.window[i].fd);
+        }
+    }
+
+    pthread_cond_destroy(&pipeline.slot_free);
+    pthread_cond_destroy(&pipeline.job_done);
+    pthread_mutex_destroy(&pipeline.lock);
+    free(threads);
+    free(pipeline.window);
+    return result;
+}
+
+// Shared state of a preallocated create; each phase hands out members by index
+typedef struct {
+    const node_t **nodes;
+    // Descriptors the walk left open, by member index, or NULL
+    held_files_t *held;
+    tar_header *headers;
+    // Metadata each header was filled from, checked again before the copy
+    struct stat *stats;
+    // Offset of each member's header block within the archive
+    off_t *offsets;
+    size_t count;
+    // Next member index to claim, advanced atomically
+    size_t next;
+    int archive_fd;
+    int failed;
+} prealloc_create_t;
+
+/*
+ * Phase 1: open every file and build its header from the open descriptor.
+ * The descriptor is closed again so a large file list does not run into the
+ * open file limit; phase 2 reopens the file and checks it is still the same.
+ */
+static void *prealloc_header_worker(void *arg) {
+    prealloc_create_t *create = arg;
+    size_t i;
+    while ((i = __atomic_fetch_add(&create->next, 1, __ATOMIC_RELAXED)) < create->count) {
+        int fd = open_member(create->nodes[i]->name, held_files_take(create->held, i),
+                             &create->headers[i], &create->stats[i]);
+        if (fd < 0) {
+            perror("Error: Failed to create tar header");
+            __atomic_store_n(&create->failed, 1, __ATOMIC_RELAXED);
+        } else if (close(fd) != 0) {
+            perror("Error closing file.");
+            __atomic_store_n(&create->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Opens member 'i' of 'create' again for its data and checks that it is the
+ * file its header was built from. Its size may have changed since: as in the
+ * serial path, prealloc_copy copies no more than the header's size and
+ * leaves the rest of the member's region zero.
+ * Returns the descriptor, which the caller must close, or -1 if an error occurs
+ */
+static int reopen_member(const prealloc_create_t *create, size_t i) {
+    const char *name = create->nodes[i]->name;
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Error: Failed to open member file");
+        return -1;
+    }
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) != 0) {
+        perror("Error: Failed to stat member file");
+        close(fd);
+        return -1;
+    }
+    const struct stat *expected = &create->stats[i];
+    if (stat_buf.st_dev != expected->st_dev || stat_buf.st_ino != expected->st_ino) {
+        fprintf(stderr, "Error: '%s' was replaced while the archive was being created\n", name);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Copies 'size' bytes from the start of 'src_fd' to 'dst_offset' in the
+ * archive, in the kernel when possible. Bytes a file gained since its header
+ * was built are left out. The padding after the data, and the data a file
+ * lost, are already zero because the archive was preallocated.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int prealloc_copy(int src_fd, int archive_fd, off_t dst_offset, size_t size,
+                         char **buffer) {
+    off_t src_offset = 0;
+    int use_kernel = 1;
+    while ((size_t) src_offset < size) {
+        size_t want = size - src_offset;
+        ssize_t n;
+        if (use_kernel) {
+            off_t out = dst_offset + src_offset;
+            n = copy_file_range(src_fd, &src_offset, archive_fd, &out, want, 0);
+            if (n < 0 && is_zero_copy_unsupported(errno) && src_offset == 0) {
+                use_kernel = 0;
+                continue;
+            }
+        } else {
+            if (*buffer == NULL && (*buffer = malloc(minitar_options.copy_chunk_size)) == NULL) {
+                perror("Failed to allocate copy buffer");
+                return -1;
+            }
+            if (want > minitar_options.copy_chunk_size) {
+                want = minitar_options.copy_chunk_size;
+            }
+            n = pread(src_fd, *buffer, want, src_offset);
+            for (ssize_t done = 0; n > 0 && done < n;) {
+                ssize_t w = pwrite(archive_fd, *buffer + done, n - done,
+                                   dst_offset + src_offset + done);
+                if (w < 0) {
+                    perror("Error: Failed to write file contents to archive");
+                    return -1;
+                }
+                done += w;
+            }
+            if (n > 0) {
+                src_offset += n;
+            }
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error reading from file");
+            return -1;
+        }
+        if (n == 0) {
+            break;    // File shrank since it was stat'ed; the rest stays zero
+        }
+    }
+    return 0;
+}
+
+// Phase 2: write each member's header and data into its own region, reading
+// the data through the descriptor that was checked against the header
+static void *prealloc_copy_worker(void *arg) {
+    prealloc_create_t *create = arg;
+    char *buffer = NULL;
+    size_t i;
+    while ((i = __atomic_fetch_add(&create->next, 1, __ATOMIC_RELAXED)) < create->count) {
+        if (__atomic_load_n(&create->failed, __ATOMIC_RELAXED)) {
+            break;
+        }
+        const tar_header *header = &create->headers[i];
+        int failed = 0;
+        if (pwrite(create->archive_fd, header, BLOCK_SIZE, create->offsets[i]) != BLOCK_SIZE) {
+            perror("Error: Failed to write header to archive");
+            failed = 1;
+        } else if (member_size(header) > 0) {
+            int src_fd = reopen_member(create, i);
+            if (src_fd < 0) {
+                failed = 1;
+            } else {
+                failed = prealloc_copy(src_fd, create->archive_fd,
+                                       create->offsets[i] + BLOCK_SIZE, member_size(header),
+                                       &buffer) != 0;
+                close(src_fd);
+            }
+        }
+        if (failed) {
+            __atomic_store_n(&create->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+/*
+ * Runs 'worker' on 'num_threads' threads sharing 'create', restarting the
+ * member counter first.
+ * Returns 0 if every member was processed successfully or -1 otherwise
+ */
+static int run_prealloc_phase(prealloc_create_t *create, void *(*worker)(void *),
+                              int num_threads) {
+    pthread_t threads[MAX_THREADS];
+    create->next = 0;
+    int num_started = 0;
+    for (; num_started < num_threads; num_started++) {
+        if (pthread_create(&threads[num_started], NULL, worker, create) != 0) {
+            break;
+        }
+    }
+    if (num_started == 0) {
+        // No threads available; do the work on the calling thread instead
+        worker(create);
+    }
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    return create->failed ? -1 : 0;
+}
+
+int create_archive_preallocated(const char *archive_name, const file_list_t *files,
+                                held_files_t *held, archive_index_t *index, int num_threads) {
+    prealloc_create_t create;
+    create.count = files->size;
+    create.held = held;
+    create.failed = 0;
+    create.nodes = malloc(create.count * sizeof(node_t *));
+    create.headers = malloc(create.count * sizeof(tar_header));
+    create.stats = malloc(create.count * sizeof(struct stat));
+    create.offsets = malloc(create.count * sizeof(off_t));
+    if (create.nodes == NULL || create.headers == NULL || create.stats == NULL ||
+        create.offsets == NULL) {
+        perror("Failed to allocate member table");
+        free(create.nodes);
+        free(create.headers);
+        free(create.stats);
+        free(create.offsets);
+        return -1;
+    }
+    size_t i = 0;
+    for (const node_t *current = files->head; current != NULL; current = current->next) {
+        create.nodes[i++] = current;
+    }
+
+    int result = run_prealloc_phase(&create, prealloc_header_worker, num_threads);
+
+    // Every size is known now, so each member's position follows from the ones before it
+    off_t archive_size = 0;
+    for (i = 0; result == 0 && i < create.count; i++) {
+        create.offsets[i] = archive_size;
+        archive_size += BLOCK_SIZE + (member_size(&create.headers[i]) + BLOCK_SIZE - 1) /
+                                         BLOCK_SIZE * BLOCK_SIZE;
+        if (index != NULL &&
+            archive_index_add(index, &create.headers[i], create.offsets[i]) != 0) {
+            result = -1;
+        }
+    }
+    if (index != NULL) {
+        index->end_offset = archive_size;
+    }
+    // The two zero footer blocks are part of the preallocated size
+    archive_size += 2 * BLOCK_SIZE;
+
+    if (result == 0) {
+        create.archive_fd = open(archive_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (create.archive_fd < 0) {
+            perror("Error: Failed to open archive file for writing");
+            result = -1;
+        } else {
+            // Reserve all blocks at once; fall back to a sparse file where unsupported
+            int err = fallocate(create.archive_fd, 0, 0, archive_size) == 0 ? 0 : errno;
+            if (err != 0 && err != EOPNOTSUPP && err != ENOSYS) {
+                errno = err;
+                perror("Error: Failed to allocate archive");
+                result = -1;
+            } else if (err != 0 && ftruncate(create.archive_fd, archive_size) != 0) {
+                perror("Error: Failed to size archive");
+                result = -1;
+            }
+            if (result == 0) {
+                result = run_prealloc_phase(&create, prealloc_copy_worker, num_threads);
+            }
+            if (close(create.archive_fd) != 0) {
+                perror("Error closing file.");
+                result = -1;
+            }
+        }
+    }
+
+    free(create.nodes);
+    free(create.headers);
+    free(create.stats);
+    free(create.offsets);
+    return result;
+}
+
+// One member for a writer thread to copy out of the archive
+typedef struct extract_job {
+    struct extract_job *next;
+    const index_entry_t *entry;
+} extract_job_t;
+
+// FIFO of jobs belonging to one writer thread
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+    extract_job_t *head;
+    extract_job_t *tail;
+    // Set by the header walker once no more jobs will be queued
+    int closed;
+    int archive_fd;
+    // Size of the archive, which every member's data must lie within
+    uint64_t archive_size;
+    int failed;
+} extract_queue_t;
+
+/*
+ * Copies 'job's data from the archive into a new file named after it.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int extract_job(const extract_queue_t *queue, const extract_job_t *job, char *buffer,
+                       size_t buffer_len) {
+    const index_entry_t *entry = job->entry;
+    int archive_fd = queue->archive_fd;
+    if (!archive_index_fits(entry, entry->size, queue->archive_size)) {
+        fprintf(stderr, "Error: Archive is truncated\n");
+        return -1;
+    }
+    tar_header header;
+    if (pread(archive_fd, &header, BLOCK_SIZE, entry->offset) != BLOCK_SIZE) {
+        perror("Error reading header from archive");
+        return -1;
+    }
+    if (archive_index_check_header(entry, &header) != 0) {
+        return -1;
+    }
+    if (header.typeflag == DELETIONTYPE || header.typeflag == LNKTYPE) {
+        // The deletion manifest was applied before the writers started, and
+        // links are made once they have finished
+        return 0;
+    }
+    if (member_is_directory(entry->name)) {
+        return make_member_directories(entry->name);
+    }
+    // Writers race to create shared parent directories, which is harmless.
+    // A name hard-linked to another is replaced rather than written through
+    unlink(entry->name);
+    int out_fd = open(entry->name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out_fd < 0 && errno == ENOENT && make_member_directories(entry->name) == 0) {
+        out_fd = open(entry->name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if (out_fd < 0) {
+        perror("Error creating output file");
+        return -1;
+    }
+    size_t done = 0;
+    while (done < entry->size) {
+        size_t want = entry->size - done < buffer_len ? entry->size - done : buffer_len;
+        ssize_t n = pread(archive_fd, buffer, want, entry->offset + BLOCK_SIZE + done);
+        if (n <= 0) {
+            perror("Error reading file content from archive");
+            close(out_fd);
+            return -1;
+        }
+        for (ssize_t written = 0; written < n;) {
+            ssize_t w = pwrite(out_fd, buffer + written, n - written, done + written);
+            if (w < 0) {
+                perror("Error writing to output file");
+                close(out_fd);
+                return -1;
+            }
+            written += w;
+        }
+        done += n;
+    }
+    if (close(out_fd) != 0) {
+        perror("Error closing output file");
+        return -1;
+    }
+    return 0;
+}
+
+static void *extract_worker(void *arg) {
+    extract_queue_t *queue = arg;
+    char *buffer = malloc(minitar_options.copy_chunk_size);
+    if (buffer == NULL) {
+        perror("Failed to allocate copy buffer");
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->head == NULL && !queue->closed) {
+            pthread_cond_wait(&queue->available, &queue->lock);
+        }
+        extract_job_t *job = queue->head;
+        if (job != NULL) {
+            queue->head = job->next;
+            if (queue->head == NULL) {
+                queue->tail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&queue->lock);
+        if (job == NULL) {
+            break;
+        }
+
+        // After a failure keep draining the queue so the walker never blocks
+        if (buffer == NULL || (!queue->failed &&
+                               extract_job(queue, job, buffer,
+                                           minitar_options.copy_chunk_size) != 0)) {
+            queue->failed = 1;
+        }
+        free(job);
+    }
+    free(buffer);
+    return NULL;
+}
+
+// Adds a job to the tail of 'queue' and wakes its writer
+static void push_extract_job(extract_queue_t *queue, extract_job_t *job) {
+    job->next = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail == NULL) {
+        queue->head = job;
+    } else {
+        queue->tail->next = job;
+    }
+    queue->tail = job;
+    pthread_cond_signal(&queue->available);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+int extract_members_parallel(const char *archive_name, const archive_index_t *index,
+                             int num_threads) {
+    // Writers read member data through their own pread calls on this descriptor
+    int archive_fd = open(archive_name, O_RDONLY);
+    if (archive_fd < 0) {
+        perror("Error opening archive file");
+        return -1;
+    }
+    struct stat archive_stat;
+    if (fstat(archive_fd, &archive_stat) != 0) {
+        perror("Failed to stat archive file");
+        close(archive_fd);
+        return -1;
+    }
+
+    extract_queue_t *queues = calloc(num_threads, sizeof(extract_queue_t));
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    if (queues == NULL || threads == NULL) {
+        perror("Failed to allocate writer threads");
+        free(queues);
+        free(threads);
+        close(archive_fd);
+        return -1;
+    }
+
+    int num_started = 0;
+    for (; num_started < num_threads; num_started++) {
+        extract_queue_t *queue = &queues[num_started];
+        pthread_mutex_init(&queue->lock, NULL);
+        pthread_cond_init(&queue->available, NULL);
+        queue->archive_fd = archive_fd;
+        queue->archive_size = archive_stat.st_size;
+        if (pthread_create(&threads[num_started], NULL, extract_worker, queue) != 0) {
+            pthread_cond_destroy(&queue->available);
+            pthread_mutex_destroy(&queue->lock);
+            break;
+        }
+    }
+
+    int result = num_started > 0 ? 0 : -1;
+    size_t next_queue = 0;
+    for (size_t i = 0; result == 0 && i < index->count; i++) {
+        const index_entry_t *entry = &index->entries[i];
+        // Only the final version of each name is written, so no two jobs
+        // touch the same file and they can be spread round-robin
+        if (!archive_index_is_final(index, entry)) {
+            continue;
+        }
+        extract_job_t *job = malloc(sizeof(extract_job_t));
+        if (job == NULL) {
+            perror("Failed to queue member for extraction");
+            result = -1;
+            break;
+        }
+        job->entry = entry;
+        push_extract_job(&queues[next_queue], job);
+        next_queue = (next_queue + 1) % num_started;
+    }
+    for (int i = 0; i < num_started; i++) {
+        pthread_mutex_lock(&queues[i].lock);
+        queues[i].closed = 1;
+        pthread_cond_signal(&queues[i].available);
+        pthread_mutex_unlock(&queues[i].lock);
+    }
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+        if (queues[i].failed) {
+            result = -1;
+        }
+        pthread_cond_destroy(&queues[i].available);
+        pthread_mutex_destroy(&queues[i].lock);
+    }
+
+    free(queues);
+    free(threads);
+    close(archive_fd);
+    return result;
+}
@@ -0,0 +1,50 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <stdio.h>
+
+#include "archive_index.h"
+#include "file_list.h"
+#include "minitar.h"
+#include "walk.h"
+
+// Upper bound accepted for the -j option
+#define MAX_THREADS 256
+
+/*
+ * Write every file in 'files' to 'archive_fp' using 'num_threads' worker
+ * threads. Workers stat files, build their headers and read small payloads
+ * ahead of time, while the calling thread writes the members in list order,
+ * so the output is byte-identical to writing them one at a time. Workers
+ * take over the descriptors in 'held', which may be NULL.
+ * If 'index' is not NULL, each member written is recorded in it.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int write_members_parallel(FILE *archive_fp, const file_list_t *files, held_files_t *held,
+                           archive_index_t *index, copy_engine_t *engine, int num_threads);
+
+/*
+ * Create the archive identified by 'archive_name' from 'files' without a
+ * serial writer. Every member's header is built first, which fixes the
+ * offset of each header and payload; the archive is then sized once with
+ * fallocate and 'num_threads' threads pwrite members into their own regions
+ * concurrently. The result is byte-identical to create_archive. Headers are
+ * built through the descriptors in 'held', which may be NULL.
+ * If 'index' is not NULL, every member is recorded in it.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int create_archive_preallocated(const char *archive_name, const file_list_t *files,
+                                held_files_t *held, archive_index_t *index, int num_threads);
+
+/*
+ * Extract the final version of every member of the archive identified by
+ * 'archive_name', as located by 'index', into the current working directory
+ * using 'num_threads' writer threads. Every final member's name must have
+ * passed check_extract_path. The calling thread hands each member
+ * to a writer, which copies it with pread/pwrite.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int extract_members_parallel(const char *archive_name, const archive_index_t *index,
+                             int num_threads);
+
+#endif    // _PARALLEL_H
@@ -0,0 +1,251 @@
+#include "snapshot.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "file_list.h"
+
+#define INITIAL_SNAPSHOT_CAPACITY 64
+
+/*
+ * Points the hash slot for entry 'pos' at it, replacing an older entry for
+ * the same path so that lookups always see the newest one.
+ */
+static void snapshot_insert_slot(snapshot_t *snapshot, size_t pos) {
+    const char *path = snapshot->entries[pos].path;
+    size_t mask = snapshot->num_slots - 1;
+    size_t slot = file_list_hash(path) & mask;
+    while (snapshot->slots[slot] != 0) {
+        if (strcmp(snapshot->entries[snapshot->slots[slot] - 1].path, path) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    snapshot->slots[slot] = pos + 1;
+}
+
+/*
+ * Grows the entry array and hash table so one more entry fits while keeping
+ * the table at most half full.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int snapshot_reserve(snapshot_t *snapshot) {
+    if (snapshot->count == snapshot->capacity) {
+        size_t new_capacity =
+            snapshot->capacity == 0 ? INITIAL_SNAPSHOT_CAPACITY : snapshot->capacity * 2;
+        snapshot_entry_t *entries =
+            realloc(snapshot->entries, new_capacity * sizeof(snapshot_entry_t));
+        if (entries == NULL) {
+            perror("Failed to grow snapshot");
+            return -1;
+        }
+        snapshot->entries = entries;
+        snapshot->capacity = new_capacity;
+    }
+
+    if ((snapshot->count + 1) * 2 > snapshot->num_slots) {
+        size_t new_num_slots = snapshot->num_slots == 0 ? INITIAL_SNAPSHOT_CAPACITY * 2
+                                                        : snapshot->num_slots * 2;
+        size_t *slots = calloc(new_num_slots, sizeof(size_t));
+        if (slots == NULL) {
+            perror("Failed to grow snapshot");
+            return -1;
+        }
+        free(snapshot->slots);
+        snapshot->slots = slots;
+        snapshot->num_slots = new_num_slots;
+        for (size_t i = 0; i < snapshot->count; i++) {
+            snapshot_insert_slot(snapshot, i);
+        }
+    }
+    return 0;
+}
+
+// Appends 'entry', taking ownership of its path
+static int snapshot_append(snapshot_t *snapshot, const snapshot_entry_t *entry) {
+    if (snapshot_reserve(snapshot) != 0) {
+        free(entry->path);
+        return -1;
+    }
+    snapshot->entries[snapshot->count] = *entry;
+    snapshot_insert_slot(snapshot, snapshot->count);
+    snapshot->count++;
+    return 0;
+}
+
+void snapshot_init(snapshot_t *snapshot) {
+    snapshot->entries = NULL;
+    snapshot->count = 0;
+    snapshot->capacity = 0;
+    snapshot->slots = NULL;
+    snapshot->num_slots = 0;
+}
+
+void snapshot_free(snapshot_t *snapshot) {
+    for (size_t i = 0; i < snapshot->count; i++) {
+        free(snapshot->entries[i].path);
+    }
+    free(snapshot->entries);
+    free(snapshot->slots);
+    snapshot_init(snapshot);
+}
+
+int snapshot_add(snapshot_t *snapshot, const char *path, const struct stat *stat_buf) {
+    snapshot_entry_t entry;
+    entry.path = strdup(path);
+    if (entry.path == NULL) {
+        perror("Failed to add path to snapshot");
+        return -1;
+    }
+    entry.dev = stat_buf->st_dev;
+    entry.ino = stat_buf->st_ino;
+    entry.size = stat_buf->st_size;
+    entry.mtime_sec = stat_buf->st_mtim.tv_sec;
+    entry.mtime_nsec = stat_buf->st_mtim.tv_nsec;
+    entry.ctime_sec = stat_buf->st_ctim.tv_sec;
+    entry.ctime_nsec = stat_buf->st_ctim.tv_nsec;
+    entry.is_dir = S_ISDIR(stat_buf->st_mode);
+    return snapshot_append(snapshot, &entry);
+}
+
+const snapshot_entry_t *snapshot_find(const snapshot_t *snapshot, const char *path) {
+    if (snapshot->num_slots == 0) {
+        return NULL;
+    }
+    size_t mask = snapshot->num_slots - 1;
+    size_t slot = file_list_hash(path) & mask;
+    while (snapshot->slots[slot] != 0) {
+        const snapshot_entry_t *entry = &snapshot->entries[snapshot->slots[slot] - 1];
+        if (strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+int snapshot_entry_changed(const snapshot_entry_t *entry, const struct stat *stat_buf) {
+    return entry->dev != (uint64_t) stat_buf->st_dev ||
+           entry->ino != (uint64_t) stat_buf->st_ino ||
+           entry->size != (uint64_t) stat_buf->st_size ||
+           entry->mtime_sec != stat_buf->st_mtim.tv_sec ||
+           entry->mtime_nsec != stat_buf->st_mtim.tv_nsec ||
+           entry->ctime_sec != stat_buf->st_ctim.tv_sec ||
+           entry->ctime_nsec != stat_buf->st_ctim.tv_nsec ||
+           entry->is_dir != S_ISDIR(stat_buf->st_mode);
+}
+
+/*
+ * A snapshot file is text: the SNAPSHOT_MAGIC line, then one line per path
+ *   DEV INO SIZE MTIME_SEC MTIME_NSEC CTIME_SEC CTIME_NSEC IS_DIR PATH_LEN PATH
+ * The path is stored by length so names containing spaces or newlines survive.
+ */
+int snapshot_load(snapshot_t *snapshot, const char *snapshot_name) {
+    FILE *snapshot_fp = fopen(snapshot_name, "r");
+    if (snapshot_fp == NULL) {
+        if (errno == ENOENT) {
+            return 0;    // First run: nothing has been archived yet
+        }
+        perror("Failed to open snapshot file");
+        return -1;
+    }
+
+    char magic[sizeof(SNAPSHOT_MAGIC) + 1];
+    if (fgets(magic, sizeof(magic), snapshot_fp) == NULL ||
+        strcmp(magic, SNAPSHOT_MAGIC "\n") != 0) {
+        fprintf(stderr, "Error: '%s' is not a minitar snapshot file\n", snapshot_name);
+        fclose(snapshot_fp);
+        return -1;
+    }
+
+    while (1) {
+        snapshot_entry_t entry;
+        unsigned long long dev, ino, size;
+        long long mtime_sec, mtime_nsec, ctime_sec, ctime_nsec;
+        size_t path_len;
+        int fields = fscanf(snapshot_fp, "%llu %llu %llu %lld %lld %lld %lld %d %zu", &dev,
+                            &ino, &size, &mtime_sec, &mtime_nsec, &ctime_sec, &ctime_nsec,
+                            &entry.is_dir, &path_len);
+        if (fields == EOF) {
+            break;
+        }
+        // The single space before the path is read by hand: a scanf space
+        // directive would also swallow whitespace the path starts with
+        if (fields != 9 || fgetc(snapshot_fp) != ' ' || path_len == 0 ||
+            path_len >= PATH_MAX || (entry.path = malloc(path_len + 1)) == NULL) {
+            fprintf(stderr, "Error: Snapshot file '%s' is corrupt\n", snapshot_name);
+            snapshot_free(snapshot);
+            fclose(snapshot_fp);
+            return -1;
+        }
+        if (fread(entry.path, 1, path_len, snapshot_fp) != path_len ||
+            fgetc(snapshot_fp) != '\n') {
+            fprintf(stderr, "Error: Snapshot file '%s' is corrupt\n", snapshot_name);
+            free(entry.path);
+            snapshot_free(snapshot);
+            fclose(snapshot_fp);
+            return -1;
+        }
+        entry.path[path_len] = '\0';
+        entry.dev = dev;
+        entry.ino = ino;
+        entry.size = size;
+        entry.mtime_sec = mtime_sec;
+        entry.mtime_nsec = mtime_nsec;
+        entry.ctime_sec = ctime_sec;
+        entry.ctime_nsec = ctime_nsec;
+        if (snapshot_append(snapshot, &entry) != 0) {
+            snapshot_free(snapshot);
+            fclose(snapshot_fp);
+            return -1;
+        }
+    }
+
+    if (fclose(snapshot_fp) != 0) {
+        perror("Error closing file.");
+        snapshot_free(snapshot);
+        return -1;
+    }
+    return 0;
+}
+
+int snapshot_save(const snapshot_t *snapshot, const char *snapshot_name) {
+    char tmp_path[PATH_MAX + 4];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", snapshot_name) >=
+        (int) sizeof(tmp_path)) {
+        fprintf(stderr, "Error: Snapshot name '%s' is too long\n", snapshot_name);
+        return -1;
+    }
+
+    // Written under a temporary name so an interrupted run keeps the old snapshot
+    FILE *snapshot_fp = fopen(tmp_path, "w");
+    if (snapshot_fp == NULL) {
+        perror("Failed to open snapshot file for writing");
+        return -1;
+    }
+    int failed = fprintf(snapshot_fp, "%s\n", SNAPSHOT_MAGIC) < 0;
+    for (size_t i = 0; i < snapshot->count && !failed; i++) {
+        const snapshot_entry_t *entry = &snapshot->entries[i];
+        size_t path_len = strlen(entry->path);
+        failed = fprintf(snapshot_fp, "%llu %llu %llu %lld %lld %lld %lld %d %zu ",
+                         (unsigned long long) entry->dev, (unsigned long long) entry->ino,
+                         (unsigned long long) entry->size, (long long) entry->mtime_sec,
+                         (long long) entry->mtime_nsec, (long long) entry->ctime_sec,
+                         (long long) entry->ctime_nsec, entry->is_dir, path_len) < 0 ||
+                 fwrite(entry->path, 1, path_len, snapshot_fp) != path_len ||
+                 fputc('\n', snapshot_fp) == EOF;
+    }
+    if (fclose(snapshot_fp) != 0) {
+        failed = 1;
+    }
+    if (failed || rename(tmp_path, snapshot_name) != 0) {
+        perror("Failed to write snapshot file");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
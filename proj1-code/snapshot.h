@@ -0,0 +1,72 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// First line of a snapshot file, naming its format
+#define SNAPSHOT_MAGIC "minitar-snapshot 1"
+
+// State of one archived path when its incremental archive was created
+typedef struct {
+    char *path;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    int is_dir;
+} snapshot_entry_t;
+
+// Every path archived by one run of an incremental (-g) create
+typedef struct {
+    snapshot_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    // Open-addressing hash table holding (entry position + 1), 0 marking a free slot
+    size_t *slots;
+    size_t num_slots;
+} snapshot_t;
+
+// Initialize a new, empty snapshot
+void snapshot_init(snapshot_t *snapshot);
+
+// Free all memory associated with the snapshot and reset it to empty
+void snapshot_free(snapshot_t *snapshot);
+
+/*
+ * Record 'path' in 'snapshot' with the metadata in 'stat_buf'.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int snapshot_add(snapshot_t *snapshot, const char *path, const struct stat *stat_buf);
+
+// Returns the entry recorded for 'path', or NULL if there is none
+const snapshot_entry_t *snapshot_find(const snapshot_t *snapshot, const char *path);
+
+/*
+ * Determine whether the file described by 'stat_buf' differs from 'entry':
+ * a different device or inode means it was replaced, and a different size,
+ * mtime or ctime means its data or metadata changed.
+ * Returns 1 if it changed, 0 otherwise.
+ */
+int snapshot_entry_changed(const snapshot_entry_t *entry, const struct stat *stat_buf);
+
+/*
+ * Load the snapshot file 'snapshot_name' into 'snapshot'. A snapshot file
+ * that does not exist yet loads as an empty snapshot, so the first
+ * incremental create archives everything (level 0).
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int snapshot_load(snapshot_t *snapshot, const char *snapshot_name);
+
+/*
+ * Write 'snapshot' to the file 'snapshot_name', replacing it only once the
+ * new contents are complete.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int snapshot_save(const snapshot_t *snapshot, const char *snapshot_name);
+
+#endif    // _SNAPSHOT_H
@@ -0,0 +1,570 @@
+#define _GNU_SOURCE
+#include "walk.h"
+#include "parallel.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bytes of directory entries fetched per getdents64 call
+#define DENTS_BUF_LEN (64 * 1024)
+// Initial number of directories a thread's deque can hold, a power of 2
+#define DEQUE_INITIAL_CAPACITY 64
+// Initial number of entries allocated for a directory
+#define DIR_INITIAL_ENTRIES 16
+// Initial number of descriptors a held_files_t table can hold
+#define HELD_INITIAL_CAPACITY 64
+// Descriptors kept open for command-line names when the open file limit is
+// unknown; otherwise half the limit, leaving the rest to the walk and the writer
+#define DEFAULT_HELD_FDS 512
+
+struct walk_dir;
+
+// One entry of a directory: a file, or a subdirectory with its own listing
+typedef struct {
+    char *path;
+    // The subdirectory's listing (sharing 'path'), or NULL for a file
+    struct walk_dir *dir;
+} walk_entry_t;
+
+// A directory and, once a thread has read it, its entries sorted by name
+typedef struct walk_dir {
+    char *path;
+    walk_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    // Descriptor the directory, or a name given on the command line, is open
+    // as, kept to hand to the archive writer, or -1
+    int fd;
+    // Set once a name given on the command line is known to be a directory,
+    // or to be neither a directory nor a regular file, and so left out
+    int is_dir;
+    int skipped;
+} walk_dir_t;
+
+// Directories waiting to be read. The owning thread pushes and pops at the
+// tail, so it walks depth-first; idle threads steal from the head, taking
+// the directories nearest the root, which tend to hold the most work
+typedef struct {
+    pthread_mutex_t lock;
+    walk_dir_t **dirs;
+    // Positions of the first and one past the last directory, modulo capacity
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} walk_deque_t;
+
+typedef struct {
+    walk_deque_t *deques;
+    int num_threads;
+    // Directories queued or being read; the walk is over when this reaches 0
+    size_t pending;
+    // Threads waiting for work, so that pushers only wake them when needed
+    int idle;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t work_available;
+    int failed;
+    // Descriptors kept open for the archive writer, and how many may be
+    size_t num_held;
+    size_t max_held;
+} walk_state_t;
+
+typedef struct {
+    walk_state_t *state;
+    int id;
+} walk_worker_t;
+
+/*
+ * Adds 'dir' at the tail of 'deque', growing it if it is full.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int deque_push(walk_deque_t *deque, walk_dir_t *dir) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail - deque->head == deque->capacity) {
+        size_t capacity = deque->capacity == 0 ? DEQUE_INITIAL_CAPACITY : 2 * deque->capacity;
+        walk_dir_t **dirs = malloc(capacity * sizeof(walk_dir_t *));
+        if (dirs == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            perror("Failed to allocate directory queue");
+            return -1;
+        }
+        for (size_t i = deque->head; i < deque->tail; i++) {
+            dirs[i & (capacity - 1)] = deque->dirs[i & (deque->capacity - 1)];
+        }
+        free(deque->dirs);
+        deque->dirs = dirs;
+        deque->capacity = capacity;
+    }
+    deque->dirs[deque->tail & (deque->capacity - 1)] = dir;
+    deque->tail++;
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+// Removes and returns the directory at the tail ('from_tail') or head of
+// 'deque', or NULL if it is empty
+static walk_dir_t *deque_take(walk_deque_t *deque, int from_tail) {
+    walk_dir_t *dir = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head != deque->tail) {
+        if (from_tail) {
+            deque->tail--;
+            dir = deque->dirs[deque->tail & (deque->capacity - 1)];
+        } else {
+            dir = deque->dirs[deque->head & (deque->capacity - 1)];
+            deque->head++;
+        }
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return dir;
+}
+
+// Takes the next directory for thread 'id': its own newest one, or else the
+// oldest one of another thread
+static walk_dir_t *find_work(walk_state_t *state, int id) {
+    walk_dir_t *dir = deque_take(&state->deques[id], 1);
+    for (int i = 1; dir == NULL && i < state->num_threads; i++) {
+        dir = deque_take(&state->deques[(id + i) % state->num_threads], 0);
+    }
+    return dir;
+}
+
+/*
+ * Queues 'dir' to be read, on thread 'id's deque, and wakes idle threads.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int queue_directory(walk_state_t *state, int id, walk_dir_t *dir) {
+    __atomic_add_fetch(&state->pending, 1, __ATOMIC_SEQ_CST);
+    if (deque_push(&state->deques[id], dir) != 0) {
+        __atomic_sub_fetch(&state->pending, 1, __ATOMIC_SEQ_CST);
+        return -1;
+    }
+    // An idle thread registers before its last look at the deques, so either
+    // it sees this directory there or it is counted here
+    if (__atomic_load_n(&state->idle, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&state->idle_lock);
+        pthread_cond_broadcast(&state->work_available);
+        pthread_mutex_unlock(&state->idle_lock);
+    }
+    return 0;
+}
+
+/*
+ * Adds the entry 'path' to 'dir', with 'subdir' as its listing if it is a
+ * directory. 'path' is owned by 'dir' afterwards.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int add_entry(walk_dir_t *dir, char *path, walk_dir_t *subdir) {
+    if (dir->count == dir->capacity) {
+        size_t capacity = dir->capacity == 0 ? DIR_INITIAL_ENTRIES : 2 * dir->capacity;
+        walk_entry_t *entries = realloc(dir->entries, capacity * sizeof(walk_entry_t));
+        if (entries == NULL) {
+            perror("Failed to allocate directory entries");
+            return -1;
+        }
+        dir->entries = entries;
+        dir->capacity = capacity;
+    }
+    dir->entries[dir->count].path = path;
+    dir->entries[dir->count].dir = subdir;
+    dir->count++;
+    return 0;
+}
+
+/*
+ * Determines the type of the entry 'd' of the directory open as 'dir_fd',
+ * with statx asking only for the type when getdents64 did not report it.
+ * Symbolic links count as the type of their target, except that links to
+ * directories are not followed.
+ * Returns DT_REG or DT_DIR for an entry to archive, 0 for one to skip, or
+ * -1 if an error occurs
+ */
+static int entry_type(int dir_fd, const char *dir_path, const struct dirent64 *d) {
+    unsigned char type = d->d_type;
+    struct statx stx;
+    if (type == DT_UNKNOWN) {
+        if (statx(dir_fd, d->d_name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, STATX_TYPE,
+                  &stx) != 0) {
+            fprintf(stderr, "Error: Failed to stat '%s/%s': %s\n", dir_path, d->d_name,
+                    strerror(errno));
+            return -1;
+        }
+        type = IFTODT(stx.stx_mode);
+    }
+    if (type == DT_LNK) {
+        if (statx(dir_fd, d->d_name, AT_STATX_DONT_SYNC, STATX_TYPE, &stx) == 0 &&
+            S_ISREG(stx.stx_mode)) {
+            return DT_REG;
+        }
+    } else if (type == DT_REG || type == DT_DIR) {
+        return type;
+    }
+    fprintf(stderr, "Warning: Skipping '%s/%s': not a regular file or directory\n", dir_path,
+            d->d_name);
+    return 0;
+}
+
+// Orders directory entries by path, which within one directory is by name
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const walk_entry_t *) a)->path, ((const walk_entry_t *) b)->path);
+}
+
+/*
+ * Reads the entries of 'dir' with getdents64 into 'buf', queueing each
+ * subdirectory on thread 'id's deque, then sorts them. A directory given on
+ * the command line is read through the descriptor it is already open as;
+ * any other is opened here and kept open for the archive writer while
+ * fewer than state->max_held descriptors are.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int read_directory(walk_state_t *state, int id, walk_dir_t *dir, char *buf) {
+    int fd = dir->fd >= 0 ? dir->fd : openat(AT_FDCWD, dir->path,
+                                             O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Failed to open directory '%s': %s\n", dir->path,
+                strerror(errno));
+        return -1;
+    }
+
+    // The root directory is the one path that already ends in '/'
+    size_t path_len = strlen(dir->path);
+    const char *separator = dir->path[path_len - 1] == '/' ? "" : "/";
+    int result = 0;
+    for (;;) {
+        ssize_t n = getdents64(fd, buf, DENTS_BUF_LEN);
+        if (n < 0) {
+            fprintf(stderr, "Error: Failed to read directory '%s': %s\n", dir->path,
+                    strerror(errno));
+            result = -1;
+        }
+        if (n <= 0) {
+            break;
+        }
+        for (ssize_t pos = 0; pos < n && result == 0;) {
+            const struct dirent64 *d = (const struct dirent64 *) (buf + pos);
+            pos += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+                continue;
+            }
+            int type = entry_type(fd, dir->path, d);
+            if (type <= 0) {
+                result = type;
+                continue;
+            }
+
+            size_t len = path_len + strlen(separator) + strlen(d->d_name) + 1;
+            char *path = malloc(len);
+            walk_dir_t *subdir = type == DT_DIR ? calloc(1, sizeof(walk_dir_t)) : NULL;
+            if (path == NULL || (type == DT_DIR && subdir == NULL)) {
+                perror("Failed to allocate directory entry");
+                free(path);
+                free(subdir);
+                result = -1;
+                break;
+            }
+            snprintf(path, len, "%s%s%s", dir->path, separator, d->d_name);
+            if (add_entry(dir, path, subdir) != 0) {
+                free(path);
+                free(subdir);
+                result = -1;
+            } else if (subdir != NULL) {
+                subdir->path = path;
+                subdir->fd = -1;
+                result = queue_directory(state, id, subdir);
+            }
+        }
+        if (result != 0) {
+            break;
+        }
+    }
+    if (fd != dir->fd &&
+        __atomic_fetch_add(&state->num_held, 1, __ATOMIC_RELAXED) < state->max_held) {
+        dir->fd = fd;
+    } else if (fd != dir->fd) {
+        close(fd);
+    }
+
+    if (dir->count > 1) {
+        qsort(dir->entries, dir->count, sizeof(walk_entry_t), compare_entries);
+    }
+    return result;
+}
+
+static void *walk_worker(void *arg) {
+    walk_worker_t *worker = arg;
+    walk_state_t *state = worker->state;
+    char *buf = malloc(DENTS_BUF_LEN);
+    if (buf == NULL) {
+        perror("Failed to allocate directory buffer");
+        __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+    }
+
+    for (;;) {
+        walk_dir_t *dir = find_work(state, worker->id);
+        if (dir == NULL) {
+            pthread_mutex_lock(&state->idle_lock);
+            __atomic_add_fetch(&state->idle, 1, __ATOMIC_SEQ_CST);
+            while ((dir = find_work(state, worker->id)) == NULL &&
+                   __atomic_load_n(&state->pending, __ATOMIC_SEQ_CST) > 0) {
+                pthread_cond_wait(&state->work_available, &state->idle_lock);
+            }
+            __atomic_sub_fetch(&state->idle, 1, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&state->idle_lock);
+            if (dir == NULL) {
+                break;
+            }
+        }
+
+        // After a failure directories are only drained, so the walk still ends
+        if (buf != NULL && !__atomic_load_n(&state->failed, __ATOMIC_RELAXED) &&
+            read_directory(state, worker->id, dir, buf) != 0) {
+            __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+        }
+        if (__atomic_sub_fetch(&state->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+            pthread_mutex_lock(&state->idle_lock);
+            pthread_cond_broadcast(&state->work_available);
+            pthread_mutex_unlock(&state->idle_lock);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+void held_files_init(held_files_t *held) {
+    held->fds = NULL;
+    held->count = 0;
+    held->capacity = 0;
+}
+
+int held_files_add(held_files_t *held, int fd) {
+    if (held->count == held->capacity) {
+        size_t capacity = held->capacity > 0 ? 2 * held->capacity : HELD_INITIAL_CAPACITY;
+        int *fds = realloc(held->fds, capacity * sizeof(int));
+        if (fds == NULL) {
+            return -1;
+        }
+        held->fds = fds;
+        held->capacity = capacity;
+    }
+    held->fds[held->count++] = fd;
+    return 0;
+}
+
+int held_files_peek(const held_files_t *held, size_t i) {
+    return held != NULL && i < held->count ? held->fds[i] : -1;
+}
+
+int held_files_take(held_files_t *held, size_t i) {
+    int fd = held_files_peek(held, i);
+    if (fd >= 0) {
+        held->fds[i] = -1;
+    }
+    return fd;
+}
+
+void held_files_close(held_files_t *held) {
+    for (size_t i = 0; i < held->count; i++) {
+        if (held->fds[i] >= 0) {
+            close(held->fds[i]);
+        }
+    }
+    free(held->fds);
+    held_files_init(held);
+}
+
+/*
+ * Adds 'path' to 'expanded', handing over the descriptor '*fd' it is open as
+ * to 'held' at the same position; '*fd' may be -1.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int add_path(file_list_t *expanded, held_files_t *held, const char *path, int *fd) {
+    if (file_list_add(expanded, path) != 0) {
+        fprintf(stderr, "Error: Could not add file '%s' to linked list\n", path);
+        return -1;
+    }
+    if (held_files_add(held, *fd) != 0) {
+        perror("Failed to allocate descriptor table");
+        return -1;
+    }
+    *fd = -1;
+    return 0;
+}
+
+/*
+ * Adds 'dir' and everything beneath it to 'expanded' in walk order.
+ * Returns 0 on success or -1 if an error occurs
+ */
+static int add_tree(file_list_t *expanded, held_files_t *held, walk_dir_t *dir) {
+    if (add_path(expanded, held, dir->path, &dir->fd) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < dir->count; i++) {
+        walk_entry_t *entry = &dir->entries[i];
+        // Files beneath a directory are opened by the writer alone
+        int no_fd = -1;
+        if (entry->dir != NULL) {
+            if (add_tree(expanded, held, entry->dir) != 0) {
+                return -1;
+            }
+        } else if (add_path(expanded, held, entry->path, &no_fd) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void free_tree(walk_dir_t *dir) {
+    for (size_t i = 0; i < dir->count; i++) {
+        if (dir->entries[i].dir != NULL) {
+            free_tree(dir->entries[i].dir);
+        } else {
+            free(dir->entries[i].path);
+        }
+    }
+    free(dir->entries);
+    free(dir->path);
+    if (dir->fd >= 0) {
+        close(dir->fd);
+    }
+    free(dir);
+}
+
+int expand_directories(const file_list_t *files, file_list_t *expanded, held_files_t *held,
+                       int num_threads) {
+    walk_state_t state;
+    state.num_threads = num_threads;
+    state.pending = 0;
+    state.idle = 0;
+    state.failed = 0;
+    long open_max = sysconf(_SC_OPEN_MAX);
+    state.num_held = 0;
+    state.max_held = open_max > 0 ? (size_t) open_max / 2 : DEFAULT_HELD_FDS;
+    state.deques = calloc(num_threads, sizeof(walk_deque_t));
+    walk_dir_t **roots = calloc(files->size > 0 ? files->size : 1, sizeof(walk_dir_t *));
+    if (state.deques == NULL || roots == NULL) {
+        perror("Failed to allocate directory walk");
+        free(state.deques);
+        free(roots);
+        return -1;
+    }
+    pthread_mutex_init(&state.idle_lock, NULL);
+    pthread_cond_init(&state.work_available, NULL);
+    for (int i = 0; i < num_threads; i++) {
+        pthread_mutex_init(&state.deques[i].lock, NULL);
+    }
+
+    // Every name is opened once. A directory is walked through that
+    // descriptor, and either way it is handed to the archive writer, so the
+    // path is looked up only here. Its type is checked first, so that a FIFO
+    // or device is never opened: those are skipped with a warning, and names
+    // that cannot be stat'ed are left for the writer, whose open_member
+    // reports them as before. Past the number of descriptors kept open, the
+    // writer opens paths again itself
+    int result = 0;
+    size_t num_roots = 0;
+    size_t i = 0;
+    for (const node_t *current = files->head; current != NULL && result == 0;
+         current = current->next, i++) {
+        roots[i] = calloc(1, sizeof(walk_dir_t));
+        if (roots[i] != NULL) {
+            roots[i]->fd = -1;
+        }
+        if (roots[i] == NULL || (roots[i]->path = strdup(current->name)) == NULL) {
+            perror("Failed to allocate directory walk");
+            result = -1;
+            break;
+        }
+        struct stat stat_buf;
+        if (stat(current->name, &stat_buf) != 0) {
+            continue;
+        }
+        if (!S_ISDIR(stat_buf.st_mode) && !S_ISREG(stat_buf.st_mode)) {
+            fprintf(stderr, "Warning: Skipping '%s': not a regular file or directory\n",
+                    current->name);
+            roots[i]->skipped = 1;
+            continue;
+        }
+        roots[i]->is_dir = S_ISDIR(stat_buf.st_mode);
+        if (state.num_held < state.max_held) {
+            // O_NONBLOCK keeps a FIFO swapped in since the stat from blocking
+            // the open; on a regular file it has no effect
+            int flags = roots[i]->is_dir ? O_RDONLY | O_DIRECTORY | O_CLOEXEC
+                                         : O_RDONLY | O_NONBLOCK | O_CLOEXEC;
+            int fd = open(current->name, flags);
+            struct stat opened;
+            if (fd >= 0 && (fstat(fd, &opened) != 0 || opened.st_dev != stat_buf.st_dev ||
+                            opened.st_ino != stat_buf.st_ino)) {
+                // Replaced since the stat; the writer looks the name up again
+                close(fd);
+                fd = -1;
+            }
+            if (fd >= 0) {
+                roots[i]->fd = fd;
+                state.num_held++;
+            }
+        }
+        if (roots[i]->is_dir) {
+            // "dir/" is walked as "dir", so its entries are named "dir/..."
+            for (size_t len = strlen(roots[i]->path);
+                 len > 1 && roots[i]->path[len - 1] == '/';) {
+                roots[i]->path[--len] = '\0';
+            }
+            result = queue_directory(&state, num_roots++ % num_threads, roots[i]);
+        }
+    }
+
+    if (result == 0 && num_roots > 0) {
+        walk_worker_t workers[MAX_THREADS];
+        pthread_t threads[MAX_THREADS];
+        int num_started = 0;
+        for (int t = 0; t < num_threads; t++) {
+            workers[t].state = &state;
+            workers[t].id = t;
+        }
+        for (; num_threads > 1 && num_started < num_threads; num_started++) {
+            if (pthread_create(&threads[num_started], NULL, walk_worker,
+                               &workers[num_started]) != 0) {
+                break;
+            }
+        }
+        if (num_started == 0) {
+            // Deques of threads that never started are emptied by stealing
+            walk_worker(&workers[0]);
+        }
+        for (int t = 0; t < num_started; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        result = state.failed ? -1 : 0;
+    }
+
+    i = 0;
+    for (const node_t *current = files->head; current != NULL && result == 0;
+         current = current->next, i++) {
+        if (roots[i]->is_dir) {
+            result = add_tree(expanded, held, roots[i]);
+        } else if (!roots[i]->skipped) {
+            result = add_path(expanded, held, current->name, &roots[i]->fd);
+        }
+    }
+
+    for (i = 0; i < (size_t) files->size; i++) {
+        if (roots[i] != NULL) {
+            free_tree(roots[i]);
+        }
+    }
+    for (int t = 0; t < num_threads; t++) {
+        free(state.deques[t].dirs);
+        pthread_mutex_destroy(&state.deques[t].lock);
+    }
+    pthread_cond_destroy(&state.work_available);
+    pthread_mutex_destroy(&state.idle_lock);
+    free(state.deques);
+    free(roots);
+    return result;
+}
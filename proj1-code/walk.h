@@ -0,0 +1,53 @@
+#ifndef _WALK_H
+#define _WALK_H
+
+#include <stddef.h>
+
+#include "file_list.h"
+
+// Descriptors the walk left open for the archive writer, by the position of
+// each name in the expanded list. The table owns every descriptor it holds
+typedef struct {
+    // fds[i] is the descriptor the i-th expanded name is open as, or -1
+    int *fds;
+    size_t count;
+    size_t capacity;
+} held_files_t;
+
+// Initialize a new, empty table
+void held_files_init(held_files_t *held);
+
+// Add 'fd', which may be -1, as the descriptor of the next expanded name
+// Returns 0 on success or -1 if an error occurs
+int held_files_add(held_files_t *held, int fd);
+
+// Descriptor held for position 'i', still owned by 'held', or -1 if there is
+// none. 'held' may be NULL
+int held_files_peek(const held_files_t *held, size_t i);
+
+// Take over the descriptor held for position 'i', or return -1 if there is
+// none. 'held' may be NULL. Different positions may be taken from several
+// threads at once
+int held_files_take(held_files_t *held, size_t i);
+
+// Close every descriptor still held and free the table
+void held_files_close(held_files_t *held);
+
+/*
+ * Copy 'files' to 'expanded', following each name that is a directory with
+ * everything beneath it, so that -c and -a accept directories. A directory
+ * comes before its contents, and the entries of each directory are sorted by
+ * name, so the result is the same for any thread count. The directories are
+ * read by 'num_threads' threads that steal unread directories from each
+ * other. Directories are not entered through symbolic links, and entries
+ * that are neither regular files nor directories, including names in 'files',
+ * are skipped with a warning without being opened.
+ * Each name in 'files' is opened only once: a directory is read through that
+ * descriptor, and the descriptor is added to 'held', which must be empty, at
+ * the name's position in 'expanded' for the archive writer to take over.
+ * Returns 0 on success or -1 if an error occurred.
+ */
+int expand_directories(const file_list_t *files, file_list_t *expanded, held_files_t *held,
+                       int num_threads);
+
+#endif    // _WALK_H